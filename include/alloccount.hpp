@@ -0,0 +1,26 @@
+#ifndef alloccount_hpp
+#define alloccount_hpp
+
+#include <opencv2/core/mat.hpp>
+
+using namespace cv;
+
+// Allocation counters, to check which frames still allocate.
+// Heap allocations are every operator new of the calling thread, replaced in alloccount.cpp.
+// Mat allocations are every cv::Mat buffer allocated by any thread, OpenCV's pool included, once
+// installMatCounter() has made the counting allocator the default; they include the other threads' Mats,
+// so a figure measured on one thread is an upper bound. OpenCV's internal scratch memory (fastMalloc) is not counted.
+namespace alloccount {
+
+long long heapAllocations();
+long long matAllocations();
+
+// make the Mat allocation counter the default allocator, before any image is processed
+void installMatCounter();
+
+// create m with the given size & type, only reallocating its buffer if it cannot be reused
+void ensureMat(Mat &m, int rows, int cols, int type);
+
+}  // namespace alloccount
+
+#endif /* alloccount_hpp */
@@ -0,0 +1,24 @@
+#ifndef batch_hpp
+#define batch_hpp
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "classify.hpp"
+#include "image.hpp"
+
+using namespace std;
+
+namespace batch {
+
+vector<string> listSourceImages(const char *source);
+
+// Classify every image of a directory, or of a text file listing one image path per line, without any window.
+// Writes the confusion matrix and the per-image predictions, and prints throughput and latency percentiles.
+int runBatchEvaluation(const char *source, FeatureModel &model, ClassifyConfig &classifier, SegmentConfig &segment,
+                       int numThreads, const char *matrixPath, const char *predictionsPath);
+
+}  // namespace batch
+
+#endif /* batch_hpp */
@@ -0,0 +1,35 @@
+#ifndef bench_hpp
+#define bench_hpp
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace bench {
+
+// Run a named micro-benchmark and print its results; returns -1 for an unknown name
+int runBenchmark(string &name, vector<string> &inputs);
+
+// KNN query latency & recall of the KD-tree against the brute-force scan, at 1k, 10k and 1M references
+int benchIndex();
+// the compiled model's nearest mean & KNN classifiers against classifyObject & classifyObjectByKNN on a synthetic 7-label db of 140, 14k and 140k rows:
+// query time, label mismatches, and the largest difference of the label averages (mean) or row distances (knn) from the scan
+int benchClassify();
+// blur5x5 against its per-pixel reference and cv::GaussianBlur, at VGA, 1080p and 4K
+int benchBlur();
+// thresholdImageFused against thresholdImageAuto & cleanUpBinary, fixed, otsu & isodata, at 1080p and 4K
+int benchThreshold();
+// time of every stage of the first calculateImgData against analyzeImage, alone and with the debug & regions images
+// of the display, on the test images at VGA, 1080p and 4K
+int benchSegment();
+// Haar face & eye detection at 1080p: the original per-frame search against the cascade engine's settings,
+// and a registry of several models against one independent pass per model
+int benchCascade();
+// aggregate throughput of 1 to all-cores concurrent streams, each with its own cascade engine,
+// over the given recorded videos (the test images if none)
+int benchStreams(vector<string> &videos);
+
+}  // namespace bench
+
+#endif /* bench_hpp */
@@ -6,6 +6,7 @@
 #include <opencv2/core/mat.hpp>
 #include <vector>
 
+#include "framesource.hpp"
 #include "opencv2/highgui.hpp"
 #include "opencv2/imgproc.hpp"
 #include "opencv2/objdetect.hpp"
@@ -14,11 +15,92 @@
 using namespace std;
 using namespace cv;
 
+// settings of the Haar cascade mode
+struct CascadeConfig {
+    double scaleFactor;  // step between the scales searched, larger is faster but may miss faces
+    int minNeighbors;    // overlapping hits a face needs to be kept
+    int minFace;         // smallest face / object side in frame pixels
+    int maxFace;         // largest face / object side in frame pixels, 0 for no limit
+    double detectScale;  // faces & eyes are searched on the frame resized by this factor, 1 for full resolution
+    int detectEvery;     // detect on every n-th frame, the faces of the frames in between are extrapolated
+    bool eyes;           // search eyes in the upper part of every face
+    vector<string> models;  // cascades of data/haarcascades to run instead of faces & eyes, by name or "all"
+
+    CascadeConfig() : scaleFactor(1.1), minNeighbors(3), minFace(60), maxFace(0), detectScale(0.5), detectEvery(1), eyes(true) {}
+};
+
+// the cascade files read once, shared read-only by every engine & registry of the process;
+// a stream clones its own classifiers from memory, as a classifier must not run on two threads at once
+struct CascadeLibrary {
+    string dirname;
+    map<string, string> files;  // model name -> XML text
+};
+
+// a face & its eyes, in frame pixels
+struct FaceDetection {
+    Rect face;
+    vector<Rect> eyes;
+};
+
+// the classifiers, and the state & buffers kept from frame to frame;
+// an engine serves one stream at a time, streams on other threads each have their own
+struct CascadeEngine {
+    CascadeClassifier face;
+    vector<CascadeClassifier> eyes;  // one per worker, a classifier must not run on two threads at once
+    Mat gray, small;                 // reused, so a frame of the same size allocates nothing
+    long long frameIndex;
+    // the faces of the last two detected frames, to extrapolate the frames in between
+    vector<FaceDetection> last, previous;
+    long long lastFrame, previousFrame;
+
+    CascadeEngine() : frameIndex(0), lastFrame(-1), previousFrame(-1) {}
+};
+
+// an object found by one of the cascades of a registry, in frame pixels
+struct CascadeHit {
+    int model;  // index in CascadeRegistry::names
+    Rect rect;
+};
+
+// any set of cascades, run over one shared gray & equalized frame; one per stream, like an engine
+struct CascadeRegistry {
+    vector<string> names;  // the label of each model, its file name without "haarcascade_" & ".xml"
+    vector<CascadeClassifier> classifiers;
+    Mat gray, small;
+    vector<vector<Rect>> found;  // per model, reused
+};
+
 namespace cascade {
 
-int cascadeVideoStream();
-void detectAndDisplay(Mat &frame);
+// the models of the face & eye engine
+const char *const FACE_MODEL = "frontalface_alt";
+const char *const EYES_MODEL = "eye_tree_eyeglasses";
+
+// names of the cascades in a directory, sorted
+vector<string> listCascades(const char *dirname = "../data/haarcascades");
+// the models a config runs: its models, or the face & eye ones
+vector<string> configModels(CascadeConfig &config);
+// read the named cascade files, "all" for every one of the directory; returns -1 if one cannot be read
+int loadLibrary(CascadeLibrary &library, vector<string> &names, const char *dirname = "../data/haarcascades");
+// a new classifier of a model of the library; returns -1 if it is not there or cannot be parsed
+int cloneClassifier(const CascadeLibrary &library, const string &name, CascadeClassifier &classifier);
+
+// clone the face & eye cascades; returns -1 if one cannot be loaded
+int loadEngine(CascadeEngine &engine, CascadeConfig &config, const CascadeLibrary &library);
+// faces of the next frame of a stream, detected or extrapolated
+void detectFaces(CascadeEngine &engine, Mat &frame, CascadeConfig &config, vector<FaceDetection> &faces);
+void drawFaces(Mat &frame, vector<FaceDetection> &faces);
+
+// clone the named cascades, "all" for every one of the library; returns -1 if one cannot be loaded
+int loadRegistry(CascadeRegistry &registry, vector<string> &names, const CascadeLibrary &library);
+// run every cascade of the registry over a frame, the hits of all models together
+void detectAll(CascadeRegistry &registry, Mat &frame, CascadeConfig &config, vector<CascadeHit> &hits);
+void drawHits(Mat &frame, CascadeRegistry &registry, vector<CascadeHit> &hits);
+
+// detect on every frame of a source, shown in a window unless headless; prints the frame rate, and a summary at the end
+int cascadeVideoStream(CascadeConfig &config, string &videoSource, SourceConfig &sourceConfig, bool headless = false);
+void detectAndDisplay(CascadeEngine &engine, Mat &frame, CascadeConfig &config);
 
 }  // namespace cascade
 
-#endif /* cascade_hpp */
\ No newline at end of file
+#endif /* cascade_hpp */
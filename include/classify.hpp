@@ -6,17 +6,66 @@
 #include <vector>
 
 #include "image.hpp"
+#include "model.hpp"
 
 using namespace std;
 
+// classifier settings
+struct ClassifyConfig {
+    string method;   // "e" Euclidean distance, "k" K-Nearest Neighbor
+    int k;           // neighbors of the KNN method
+    double maxDist;  // a larger distance to the best match is labeled "unknown"
+    bool weighted;   // KNN neighbors vote with 1 / distance
+    bool useIndex;   // KNN searches a KD-tree instead of scanning every training feature
+    double indexEps;  // 0 for exact KD-tree queries, larger is faster but may miss true neighbors
+    bool legacy;     // classify with the original per-call scan of the feature map, to validate the compiled model
+
+    ClassifyConfig() : method("k"), k(8), maxDist(1000), weighted(false), useIndex(false), indexEps(0.0), legacy(false) {}
+};
+
+// number of Hu moments kept in a Feature
+const int NUM_HU_MOMENTS = 6;
+
+// running count, mean and sum of squared deviations of one value (Welford's method);
+// numerically stable in one pass, and two partial results merge into the result of their union
+struct RunningStat {
+    long long count;
+    double mean;
+    double m2;
+
+    RunningStat() : count(0), mean(0.0), m2(0.0) {}
+};
+
+// running statistics of every feature dimension, fed as the features are extracted
+struct FeatureStats {
+    RunningStat fillRatio;
+    RunningStat bboxDimRatio;
+    RunningStat axisDimRatio;
+    RunningStat huMoments[NUM_HU_MOMENTS];
+};
+
 namespace classify {
 
+void addSample(RunningStat &stat, double value);
+void mergeStats(RunningStat &dst, const RunningStat &src);
+// population standard deviation, 0 without samples
+double stdDev(const RunningStat &stat);
+
+void addFeature(FeatureStats &stats, Feature &feature);
+void mergeFeatureStats(FeatureStats &dst, const FeatureStats &src);
+Feature featureStdDev(const FeatureStats &stats);
+
 Feature calculateFeatureStdDev(vector<ImgData> &traingImgData);
 double calculateStdDev(vector<double> &data);
-string classifyObject(Feature &src, map<string, vector<Feature>> &db, Feature &stdDevFeature);
+string classifyObject(Feature &src, map<string, vector<Feature>> &db, Feature &stdDevFeature, double maxDist = 1000);
 double euclideanDist(Feature &src, Feature &cmp, Feature &stdDevFeature);
 
-string classifyObjectByKNN(Feature &src, map<string, vector<Feature>> &db, Feature &stdDevFeature);
+string classifyObjectByKNN(Feature &src, map<string, vector<Feature>> &db, Feature &stdDevFeature, int k = 8, double maxDist = 1000);
+
+// classify against the compiled model, with the method & settings of the config
+string classifyFeature(Feature &src, FeatureModel &model, ClassifyConfig &config);
+// label every detection of a frame, in parallel
+void classifyDetections(vector<Detection> &detections, FeatureModel &model, ClassifyConfig &config);
 
 }  // namespace classify
 
@@ -0,0 +1,34 @@
+#ifndef featuredb_hpp
+#define featuredb_hpp
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "classify.hpp"
+#include "image.hpp"
+
+using namespace std;
+
+namespace featuredb {
+
+// identity of a training image, used to invalidate a stale database
+struct SourceFile {
+    string name;
+    long long mtime;
+    long long size;
+};
+
+// training image files in a directory, sorted by name
+vector<SourceFile> scanSourceFiles(const char *dirname);
+
+// load the binary feature database & its feature statistics; returns false if it is missing, corrupt, of another version,
+// or out of date with the training files or the segmentation settings
+bool load(const char *path, vector<SourceFile> &sources, const SegmentConfig &config, map<string, vector<Feature>> &db, FeatureStats &stats);
+// write the binary feature database; the statistics are kept as running counts, means & squared deviations
+// rather than standard deviations, so later samples can be merged into them with classify::mergeFeatureStats; returns a non-zero value in case of an error
+int save(const char *path, vector<SourceFile> &sources, const SegmentConfig &config, map<string, vector<Feature>> &db, FeatureStats &stats);
+
+}  // namespace featuredb
+
+#endif /* featuredb_hpp */
@@ -0,0 +1,50 @@
+#ifndef framesource_hpp
+#define framesource_hpp
+
+#include <opencv2/core/mat.hpp>
+#include <opencv2/videoio.hpp>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace cv;
+
+// how the frames of a source are delivered
+struct SourceConfig {
+    double fps;           // deliver recorded frames at most this fast, 0 for as fast as they can be read; cameras are never paced
+    int loops;            // play a file, sequence or directory this many times
+    long long maxFrames;  // stop after this many frames, 0 for no limit
+
+    SourceConfig() : fps(0.0), loops(1), maxFrames(0) {}
+};
+
+// Frames of a camera, a video file, an image sequence pattern (img_%04d.jpg) or a directory of images.
+// Anything but a camera gives the same frames in the same order on every run, and is never dropped from,
+// so a headless run over it is reproducible.
+struct FrameSource {
+    string spec;
+    bool live;             // a camera, whose frames are lost when not read in time
+    VideoCapture capture;  // camera, file or pattern
+    vector<string> files;  // directory images, sorted by name
+    Size frameSize;        // directory images are resized to the first one, read by open, like the frames of a video
+    SourceConfig config;
+    size_t next;           // next directory image
+    int loop;
+    long long delivered;
+    int64 startTick;
+
+    FrameSource() : live(false), next(0), loop(0), delivered(0), startTick(0) {}
+};
+
+namespace framesource {
+
+// open a source: all digits for a camera index, a directory, or anything VideoCapture reads; returns false on failure
+bool open(FrameSource &source, const string &spec, const SourceConfig &config = SourceConfig());
+// the next frame, paced to config.fps unless the source is live; returns false at the end of the source
+bool read(FrameSource &source, Mat &frame);
+// frame size of the source, known before the first read: the first image of a directory, or what the capture reports
+Size frameSize(FrameSource &source);
+
+}  // namespace framesource
+
+#endif /* framesource_hpp */
@@ -1,9 +1,13 @@
 #ifndef image_hpp
 #define image_hpp
 
+#include <memory>
 #include <opencv2/core/mat.hpp>
+#include <string>
 #include <vector>
 
+#include "timing.hpp"
+
 using namespace cv;
 using namespace std;
 
@@ -15,34 +19,101 @@ struct Feature {
     vector<double> huMoments;
 };
 
-// define image data
-struct ImgData {
+// an object found in a frame, in multi-object mode
+struct Detection {
+    vector<Point> contour;
+    double area;  // contour area in pixels
+    RotatedRect bbox;
+    Feature features;
+    vector<Point> axisEndPoints;
+    string label;
+};
+
+// the intermediate images of an analysis, only kept for display
+struct ImgDebug {
     Mat original;
     Mat thresholded;
-    Mat regions;
+    Mat regions;  // colored regions, only built with SegmentConfig::withRegions
     int numRegions;
+    Mat regionStats;  // connected components stats, one row per region
+    vector<vector<Point>> contours;
+};
+
+// define image data: the compact result of the analysis of an image.
+// It is move-only, so the contour, detections and optional debug imagery are never copied by accident.
+struct ImgData {
     RotatedRect bbox;
     Feature features;
-    vector<vector<Point>> contours;
+    vector<Point> contour;  // the largest contour, empty if the image has no object
     vector<Point> axisEndPoints;
     string label;
+    int threshold;                 // gray level the image was thresholded at, -1 for the adaptive method
+    vector<Detection> detections;  // every region above the area threshold, only in multi-object mode
+    unique_ptr<ImgDebug> debug;    // only with SegmentConfig::withDebug
+
+    ImgData() : threshold(0) {}
+    ImgData(ImgData &&) = default;
+    ImgData &operator=(ImgData &&) = default;
+    ImgData(const ImgData &) = delete;
+    ImgData &operator=(const ImgData &) = delete;
+};
+
+// segmentation settings
+struct SegmentConfig {
+    int threshold;     // gray level below which a pixel belongs to an object
+    string thresholdMethod;  // "fixed" threshold, "otsu" or "isodata" from the frame's histogram, or "adaptive" local mean
+    int adaptiveBlock;       // neighborhood size of the adaptive method, odd
+    double adaptiveC;        // an object pixel is darker than its neighborhood mean by more than this
+    bool withDebug;    // keep the intermediate images & all contours in ImgData::debug, for display
+    bool withRegions;  // with withDebug, also build the colored regions image
+    bool multiObject;  // detect every region above minArea, not only the largest contour
+    double minArea;    // smallest contour area of a detection, in pixels
+    int pyramidLevels;   // segment at 1 / 2^levels of the resolution, contours are mapped back to full resolution
+    bool pyramidRefine;  // re-trace the contours at full resolution, inside the region found at low resolution
+    int closeIterations;  // morphological closing of the thresholded image, 0 to skip
+    bool fused;           // threshold & close in cache-sized strips, same result as the separate passes
+
+    SegmentConfig() : threshold(100), thresholdMethod("fixed"), adaptiveBlock(51), adaptiveC(10), withDebug(false), withRegions(false), multiObject(false), minArea(1000), pyramidLevels(0), pyramidRefine(false), closeIterations(0), fused(false) {}
 };
 
 namespace image {
 
 // threshold & clean up
 int blur5x5(cv::Mat &src, cv::Mat &dst);
-Mat thresholdImage(Mat &image);
+int blur5x5Reference(cv::Mat &src, cv::Mat &dst);
+Mat thresholdImage(Mat &image, int threshold = 100);
 vector<pair<Mat, Mat>> thresholdImages(vector<Mat> &images);
-cv::Mat cleanUpBinary(cv::Mat &image);
+cv::Mat cleanUpBinary(cv::Mat &image, int iterations = 5);
+// thresholdImage followed by cleanUpBinary, in one pass over horizontal strips;
+// method "otsu" or "isodata" picks the threshold from the frame's histogram instead, returned in chosen
+Mat thresholdImageFused(Mat &image, int threshold = 100, int closeIterations = 0, const string &method = "fixed", int *chosen = NULL);
+void thresholdImageFused(Mat &image, Mat &dst, int threshold, int closeIterations, const string &method = "fixed", int *chosen = NULL);
+
+// automatic thresholds, computed on a 256-bin histogram of the blurred gray image
+void addHistogram(const Mat &gray, int hist[256]);
+int otsuThreshold(const int hist[256]);
+int isodataThreshold(const int hist[256]);
+Mat thresholdImageAuto(Mat &image, const SegmentConfig &config, int &chosen);
 
 // regions
 pair<Mat, int> connectedComponents(Mat &src);
+Mat colorRegions(Mat &labelImage, int nLabels);
 vector<pair<Mat, Mat>> connectedComponentsImages(vector<Mat> &images);
 
 // image data & features
-ImgData calculateImgData(Mat &src);
+// with a non-empty roi only that part of src is segmented; contours, bboxes & axes stay in src coordinates,
+// the debug images cover the roi only, at the pyramid resolution in pyramid mode.
+// No contour found leaves the contour empty and no features.
+ImgData calculateImgData(Mat &src, const SegmentConfig &config = SegmentConfig(), StageTimer *timer = NULL, const Rect &roi = Rect());
+// the same analysis into an existing ImgData, reusing its buffers; frames of one size stop allocating Mats,
+// except in --refine mode (the re-traced region changes every frame) and for the debug images
+void analyzeImage(Mat &src, ImgData &res, const SegmentConfig &config = SegmentConfig(), StageTimer *timer = NULL, const Rect &roi = Rect());
 Feature calculateFeatures(Mat &regions, vector<vector<Point>> &contours, int maxIdx, RotatedRect &bbox, vector<Point> &axes);
+void detectObjects(vector<vector<Point>> &contours, ImgData &imgData, const SegmentConfig &config);
+
+// pyramid mode
+void upscaleContours(vector<vector<Point>> &contours, int factor, Point offset);
+void refineContours(Mat &src, vector<vector<Point>> &contours, int factor, const SegmentConfig &config);
 
 }  // namespace image
 
@@ -0,0 +1,34 @@
+#ifndef kdtree_hpp
+#define kdtree_hpp
+
+#include <utility>
+#include <vector>
+
+#include "model.hpp"
+
+using namespace std;
+
+struct KdNode {
+    int begin, end;   // rows of the node, a range of KdTree::rows
+    int left, right;  // children, -1 for a leaf
+    int dim;          // split dimension
+    double split;     // rows of the left child are <= split along dim
+};
+
+// KD-tree over the scaled feature rows of a FeatureModel, for k nearest neighbor queries under its L1 distance
+struct KdTree {
+    vector<KdNode> nodes;   // nodes[0] is the root
+    vector<int> rows;       // model rows, ordered so every node's rows are contiguous
+    vector<double> points;  // the rows' values in that order, MODEL_DIMS per row
+    double eps;             // 0 for exact queries; > 0 returns neighbors within (1 + eps) of the true ones, faster
+};
+
+namespace kdtree {
+
+KdTree buildTree(FeatureModel &model, double eps, int leafSize = 16);
+// the k nearest (distance, row) pairs of a scaled query, nearest first, ties to the lower row
+void knnSearch(KdTree &tree, const double *query, int k, vector<pair<double, int>> &nearest);
+
+}  // namespace kdtree
+
+#endif /* kdtree_hpp */
@@ -0,0 +1,63 @@
+#ifndef model_hpp
+#define model_hpp
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "image.hpp"
+
+using namespace std;
+
+// Number of dimensions compared by classify::euclideanDist: fill ratio, bounding box ratio, axis ratio, and Hu moments norm
+const int MODEL_DIMS = 4;
+
+struct KdTree;
+
+// Training features compiled for classification.
+// Every feature is reduced to the MODEL_DIMS values euclideanDist compares, already divided by their standard deviation,
+// and stored column by column (structure of arrays) so the distance to every row is one linear, vectorizable pass.
+struct FeatureModel {
+    vector<string> labels;           // label names, the label id is the index
+    vector<int> labelIds;            // label id of each row
+    vector<int> labelCounts;         // number of rows of each label
+    vector<double> cols[MODEL_DIMS];  // scaled feature values, one column per dimension
+    double scale[MODEL_DIMS];         // 1 / standard deviation of each dimension
+    int numRows;
+    shared_ptr<KdTree> index;         // optional, used by the KNN method instead of scanning every row
+
+    // per-label statistics of the nearest mean method: every label's values of each dimension sorted,
+    // with running sums, give the sum of distances from a query to all rows of the label in O(log rows)
+    vector<int> labelStarts;                // first row of each label, plus numRows at the end
+    vector<double> sortedCols[MODEL_DIMS];  // cols sorted within each label's rows
+    vector<double> prefixSums[MODEL_DIMS];  // prefixSums[d][i] = sum of sortedCols[d][0, i)
+
+    // the original training features, only set to validate against the legacy classifiers
+    map<string, vector<Feature>> *legacyDb;
+    Feature *legacyStdDev;
+};
+
+namespace model {
+
+FeatureModel compileModel(map<string, vector<Feature>> &db, Feature &stdDevFeature);
+void scaleFeature(FeatureModel &model, Feature &src, double *query);
+// L1 distance from a scaled query to every row, the same value as euclideanDist
+void distances(FeatureModel &model, const double *query, double *dists);
+// average distance from a scaled query to the rows of each label, as classifyObject computes it up to rounding
+void meanDistances(FeatureModel &model, const double *query, double *means);
+// build the KD-tree index; eps 0 keeps KNN exact, a larger eps trades accuracy for speed
+void buildIndex(FeatureModel &model, double eps);
+// the k nearest (distance, row) pairs of a scaled query, nearest first; through the index if there is one
+void nearestRows(FeatureModel &model, const double *query, int k, vector<pair<double, int>> &nearest);
+
+// the classifiers return a label id, or -1 for unknown; a warmed-up thread classifies without any heap allocation
+int classifyNearestMeanId(FeatureModel &model, Feature &src, double maxDist);
+int classifyKNNId(FeatureModel &model, Feature &src, int k, double maxDist, bool weighted);
+
+string classifyNearestMean(FeatureModel &model, Feature &src, double maxDist);
+string classifyKNN(FeatureModel &model, Feature &src, int k, double maxDist, bool weighted = false);
+
+}  // namespace model
+
+#endif /* model_hpp */
@@ -0,0 +1,46 @@
+#ifndef options_hpp
+#define options_hpp
+
+#include <string>
+#include <vector>
+
+#include "cascade.hpp"
+#include "classify.hpp"
+#include "framesource.hpp"
+#include "image.hpp"
+#include "pipeline.hpp"
+
+using namespace std;
+
+// command line settings, defaults match the interactive version of the program
+struct Options {
+    string trainingDir;
+    string featureDbPath;
+    string testSource;  // test directory, or a text file listing one image path per line
+    string videoSource;         // video mode: camera index, video file, image sequence pattern or image directory
+    SourceConfig sourceConfig;  // pacing & length of the video sources
+    vector<string> streams;  // video sources served together instead of videoSource
+    string matrixPath;
+    string predictionsPath;
+    string mode;   // "v" video, "p" photo; empty to ask on stdin
+    string bench;  // name of a micro-benchmark to run instead
+    vector<string> benchInputs;  // recordings of the streams benchmark
+    int numThreads;
+    bool headless;  // no windows: photo mode becomes a batch evaluation, video mode does not render
+    ClassifyConfig classifier;  // empty method to ask on stdin, "c" for Haar cascade
+    SegmentConfig segment;
+    CascadeConfig cascade;
+    pipeline::PipelineConfig pipeline;
+
+    Options();
+};
+
+namespace options {
+
+// returns 0 on success, 1 if the usage was printed on request, -1 on an invalid command line
+int parseOptions(int argc, char *argv[], Options &opts);
+void printUsage(const char *program);
+
+}  // namespace options
+
+#endif /* options_hpp */
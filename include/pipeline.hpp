@@ -0,0 +1,39 @@
+#ifndef pipeline_hpp
+#define pipeline_hpp
+
+#include <map>
+#include <opencv2/core/mat.hpp>
+#include <opencv2/videoio.hpp>
+#include <string>
+#include <vector>
+
+#include "classify.hpp"
+#include "framesource.hpp"
+#include "image.hpp"
+#include "tracking.hpp"
+
+using namespace std;
+using namespace cv;
+
+namespace pipeline {
+
+struct PipelineConfig {
+    int queueCapacity;  // frames buffered between two stages, at least 2
+    bool dropOldest;    // when a stage falls behind, drop its oldest queued frame instead of stalling the stage before it
+    int reportEvery;    // print queue depths and latency every N rendered frames, 0 to disable
+    bool headless;      // annotate the frames but do not show them
+    TrackConfig tracking;    // segment around the last object instead of the full frame
+    SmoothConfig smoothing;  // cache & smooth the labels of each tracked object
+
+    PipelineConfig() : queueCapacity(4), dropOldest(true), reportEvery(100), headless(false) {}
+};
+
+// Run the video loop as four threads, capture -> segmentation & features -> classification -> render.
+// Rendering stays on the calling thread, as highgui requires; 'q' or the end of the stream stops the pipeline.
+// Frames of a recorded source are never dropped, and the run ends with a summary whose label digest
+// is the same on every run over the same frames & settings.
+int runVideoPipeline(FrameSource &source, FeatureModel &model, ClassifyConfig &classifier, SegmentConfig &segment, PipelineConfig &config);
+
+}  // namespace pipeline
+
+#endif /* pipeline_hpp */
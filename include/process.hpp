@@ -6,21 +6,24 @@
 #include <opencv2/core/mat.hpp>
 #include <vector>
 
+#include "classify.hpp"
 #include "image.hpp"
 
 using namespace std;
 using namespace image;
 
 namespace process {
+vector<string> listImageFiles(const char *dirname);
 void loadImages(vector<cv::Mat> &images, const char *dirname, vector<string> &actualLabels);
 void loadTrainingImages(vector<cv::Mat> &images, const char *dirname, vector<std::string> &labels);
+void loadTrainingImgData(vector<ImgData> &imgData, const char *dirname, int numThreads, const SegmentConfig &config = SegmentConfig(), FeatureStats *stats = NULL);
 void displayResults(vector<cv::Mat> &images);
 void displayResultsInOneWindow(vector<cv::Mat> &images);
 void printModeDescriptions();
 
 // A3
 void displayResultsWithFeaturesAsImage(string displayName, ImgData &imgData);
-void buildMatrixTable(vector<string> &actualLabels, vector<string> &detectedLabels);
+void buildMatrixTable(vector<string> &actualLabels, vector<string> &detectedLabels, const char *path = "../data/csv/matrix.csv");
 
 // Video
 int displayResultsWithFeaturesInVideoFrame(cv::Mat &frame, ImgData &imgData);
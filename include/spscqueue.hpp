@@ -0,0 +1,142 @@
+#ifndef spscqueue_hpp
+#define spscqueue_hpp
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Bounded lock-free queue between one producer and one consumer thread.
+// Every slot carries a sequence number (Vyukov's bounded queue), so besides the consumer the producer can also pop:
+// that is how pushDropOldest() evicts the oldest item when the consumer falls behind.
+template <typename T>
+class SpscQueue {
+public:
+    // capacity is rounded up to a power of two, of at least 2: in a single cell the slot a push frees
+    // has the sequence number of the next push, which would overwrite the item before it is popped
+    explicit SpscQueue(size_t capacity) : cells(roundUp(capacity)), mask(cells.size() - 1), head(0), tail(0), dropped(0) {
+        for (size_t i = 0; i < cells.size(); i++) {
+            cells[i].seq.store(i, memory_order_relaxed);
+        }
+    }
+
+    // producer only; returns false if the queue is full
+    bool tryPush(T &item) {
+        size_t pos = head.load(memory_order_relaxed);
+        Cell &cell = cells[pos & mask];
+        if (cell.seq.load(memory_order_acquire) != pos) {
+            return false;
+        }
+        cell.data = std::move(item);
+        cell.seq.store(pos + 1, memory_order_release);
+        head.store(pos + 1, memory_order_release);
+        return true;
+    }
+
+    // producer only; waits for space, returns false if cancel is set while waiting
+    bool push(T &item, atomic<bool> &cancel) {
+        for (int spins = 0; !tryPush(item); spins++) {
+            if (cancel.load(memory_order_acquire)) {
+                return false;
+            }
+            backoff(spins);
+        }
+        return true;
+    }
+
+    // producer only; when full, discard the oldest item instead of waiting
+    void pushDropOldest(T &item) {
+        T discarded;
+        while (!tryPush(item)) {
+            if (tryPop(discarded)) {
+                dropped.fetch_add(1, memory_order_relaxed);
+            }
+        }
+    }
+
+    // returns false if the queue is empty
+    bool tryPop(T &item) {
+        size_t pos = tail.load(memory_order_relaxed);
+        for (;;) {
+            Cell &cell = cells[pos & mask];
+            size_t seq = cell.seq.load(memory_order_acquire);
+            long dif = (long)seq - (long)(pos + 1);
+            if (dif == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    item = std::move(cell.data);
+                    cell.seq.store(pos + mask + 1, memory_order_release);
+                    return true;
+                }
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = tail.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    // consumer only; waits for an item, returns false once the queue is empty and done is set
+    bool pop(T &item, atomic<bool> &done) {
+        for (int spins = 0;; spins++) {
+            if (tryPop(item)) {
+                return true;
+            }
+            // the producer sets done after its last push, so one more try drains the queue
+            if (done.load(memory_order_acquire)) {
+                return tryPop(item);
+            }
+            backoff(spins);
+        }
+    }
+
+    // approximate number of queued items, safe to read from any thread
+    size_t depth() {
+        size_t h = head.load(memory_order_acquire);
+        size_t t = tail.load(memory_order_acquire);
+        return h > t ? h - t : 0;
+    }
+
+    // number of items evicted by pushDropOldest()
+    size_t droppedCount() {
+        return dropped.load(memory_order_relaxed);
+    }
+
+private:
+    struct Cell {
+        atomic<size_t> seq;
+        T data;
+
+        Cell() : seq(0) {}
+    };
+
+    static size_t roundUp(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        return size;
+    }
+
+    // spin briefly, then yield, then sleep, so an idle stage does not burn a core
+    static void backoff(int spins) {
+        if (spins < 64) {
+            return;
+        }
+        if (spins < 128) {
+            this_thread::yield();
+        } else {
+            this_thread::sleep_for(chrono::microseconds(200));
+        }
+    }
+
+    vector<Cell> cells;
+    size_t mask;
+    // keep the producer and consumer indexes on separate cache lines
+    alignas(64) atomic<size_t> head;
+    alignas(64) atomic<size_t> tail;
+    atomic<size_t> dropped;
+};
+
+#endif /* spscqueue_hpp */
@@ -0,0 +1,27 @@
+#ifndef streams_hpp
+#define streams_hpp
+
+#include <string>
+#include <vector>
+
+#include "classify.hpp"
+#include "framesource.hpp"
+#include "image.hpp"
+#include "pipeline.hpp"
+
+using namespace std;
+
+namespace streams {
+
+// Serve several video sources from one process: a capture thread per source, and one pool of numWorkers threads
+// that take the next frame of the streams in turn, so every stream gets its share however fast its source is.
+// A source is anything framesource::open takes: a device index, a video file, an image sequence pattern
+// such as frames/img_%04d.jpg, or a directory of images; every source is paced & limited by sourceConfig.
+// All streams classify against the same model; each keeps its own tracking & label state,
+// and per-stream frame rate & latency are printed every config.reportEvery frames and at the end.
+int runStreams(vector<string> &sources, SourceConfig &sourceConfig, FeatureModel &model, ClassifyConfig &classifier, SegmentConfig &segment,
+               pipeline::PipelineConfig &config, int numWorkers);
+
+}  // namespace streams
+
+#endif /* streams_hpp */
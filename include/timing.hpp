@@ -0,0 +1,76 @@
+#ifndef timing_hpp
+#define timing_hpp
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <opencv2/core/utility.hpp>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Accumulate wall-clock time per named stage, in the order the stages are first seen
+struct StageTimer {
+    vector<string> stages;
+    vector<double> totalMs;
+    vector<int> counts;
+    int64 mark;
+
+    StageTimer() : mark(cv::getTickCount()) {}
+
+    // restart the clock
+    void begin() {
+        mark = cv::getTickCount();
+    }
+
+    // charge the time since the last begin() / lap() to a stage, and restart the clock
+    void lap(const string &stage) {
+        int64 now = cv::getTickCount();
+        double ms = (now - mark) * 1000.0 / cv::getTickFrequency();
+        mark = now;
+
+        int idx = 0;
+        while (idx < stages.size() && stages[idx] != stage) {
+            idx++;
+        }
+        if (idx == stages.size()) {
+            stages.push_back(stage);
+            totalMs.push_back(0.0);
+            counts.push_back(0);
+        }
+        totalMs[idx] += ms;
+        counts[idx]++;
+    }
+
+    // print the average time of each stage
+    void report(const char *title) {
+        printf("%s\n", title);
+        double sum = 0.0;
+        for (int i = 0; i < stages.size(); i++) {
+            double avg = totalMs[i] / counts[i];
+            sum += avg;
+            printf("  %-12s %8.3f ms  (%d samples)\n", stages[i].c_str(), avg, counts[i]);
+        }
+        printf("  %-12s %8.3f ms\n", "total", sum);
+    }
+
+    void reset() {
+        stages.clear();
+        totalMs.clear();
+        counts.clear();
+    }
+};
+
+// Nearest-rank percentile of a list of samples, p in [0, 100]
+inline double percentile(vector<double> samples, double p) {
+    if (samples.empty()) {
+        return 0.0;
+    }
+    sort(samples.begin(), samples.end());
+    int rank = (int)ceil(p / 100.0 * samples.size());
+    rank = min(max(rank, 1), (int)samples.size());
+    return samples[rank - 1];
+}
+
+#endif /* timing_hpp */
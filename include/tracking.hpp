@@ -0,0 +1,72 @@
+#ifndef tracking_hpp
+#define tracking_hpp
+
+#include <deque>
+#include <opencv2/core/mat.hpp>
+#include <string>
+#include <vector>
+
+#include "classify.hpp"
+#include "image.hpp"
+#include "model.hpp"
+#include "timing.hpp"
+
+using namespace cv;
+using namespace std;
+
+// ROI tracking settings
+struct TrackConfig {
+    bool enabled;
+    int keyframeEvery;  // segment the full frame every N frames, whatever the track
+    double padding;     // margin added around the last bbox, as a fraction of its size
+
+    TrackConfig() : enabled(false), keyframeEvery(30), padding(0.5) {}
+};
+
+// state of the tracked object(s) between frames
+struct RoiTracker {
+    bool active;        // roi holds the padded bbox of the last frame
+    Rect roi;
+    int sinceKeyframe;  // frames since the last full-frame pass
+    long long fullPasses, roiPasses;
+
+    RoiTracker() : active(false), sinceKeyframe(0), fullPasses(0), roiPasses(0) {}
+};
+
+// label smoothing & classification cache settings
+struct SmoothConfig {
+    bool enabled;
+    double cacheEps;  // reuse the last label while the scaled features moved less than this L1 distance, 0 to always classify
+    int window;       // majority vote over the labels of the last N frames
+
+    SmoothConfig() : enabled(false), cacheEps(0.1), window(5) {}
+};
+
+// an object followed across frames, with its recent labels
+struct LabelTrack {
+    Point2f center;
+    double query[MODEL_DIMS];  // scaled features of the last classified frame
+    string lastLabel;          // raw label of the last classified frame
+    deque<string> history;     // raw labels of the recent frames, newest last
+    string stableLabel;        // label shown, changes only when another label wins the majority
+    int missed;                // frames since the object was last seen
+};
+
+// tracks of the classification stage, matched to the objects of each new frame by position
+struct LabelTracker {
+    vector<LabelTrack> tracks;
+    long long classified, cached;
+
+    LabelTracker() : classified(0), cached(0) {}
+};
+
+namespace tracking {
+
+// Segment a frame into res, only inside the roi of the last frame while the track holds
+void analyzeFrame(RoiTracker &tracker, Mat &frame, ImgData &res, const SegmentConfig &segment, const TrackConfig &config, StageTimer *timer = NULL);
+// Label the object(s) of a frame through their tracks: cached while the features barely change, smoothed by a majority vote
+void labelFrame(LabelTracker &tracker, ImgData &imgData, FeatureModel &model, ClassifyConfig &classifier, const SmoothConfig &config);
+
+}  // namespace tracking
+
+#endif /* tracking_hpp */
@@ -0,0 +1,92 @@
+#include "alloccount.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static thread_local long long heapCount = 0;
+static std::atomic<long long> matCount(0);
+
+// The default Mat allocator, counting the buffers it allocates. Deallocation goes straight to the wrapped
+// allocator, which the buffers it created point back to.
+class CountingMatAllocator : public MatAllocator {
+public:
+    explicit CountingMatAllocator(MatAllocator *base) : base(base) {}
+
+    UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step, AccessFlag flags, UMatUsageFlags usageFlags) const override {
+        if (data == NULL) {
+            matCount++;
+        }
+        return base->allocate(dims, sizes, type, data, step, flags, usageFlags);
+    }
+
+    bool allocate(UMatData *data, AccessFlag accessflags, UMatUsageFlags usageFlags) const override {
+        return base->allocate(data, accessflags, usageFlags);
+    }
+
+    void deallocate(UMatData *data) const override {
+        base->deallocate(data);
+    }
+
+private:
+    MatAllocator *base;
+};
+
+// Replacements of the global allocation functions, counting per thread; the deallocation functions
+// must be replaced along with them, and the array & nothrow forms fall back on these two
+void *operator new(size_t size) {
+    heapCount++;
+    void *p = malloc(size ? size : 1);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+    heapCount++;
+    return malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+    return operator new(size, std::nothrow);
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+    free(p);
+}
+
+long long alloccount::heapAllocations() {
+    return heapCount;
+}
+
+long long alloccount::matAllocations() {
+    return matCount.load();
+}
+
+void alloccount::installMatCounter() {
+    static CountingMatAllocator allocator(Mat::getStdAllocator());
+    Mat::setDefaultAllocator(&allocator);
+}
+
+void alloccount::ensureMat(Mat &m, int rows, int cols, int type) {
+    if (m.rows != rows || m.cols != cols || m.type() != type) {
+        m.create(rows, cols, type);
+    }
+}
@@ -0,0 +1,188 @@
+#include "batch.hpp"
+
+#include <dirent.h>
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <opencv2/opencv.hpp>
+#include <thread>
+
+#include "classify.hpp"
+#include "process.hpp"
+#include "timing.hpp"
+
+using namespace cv;
+using namespace std;
+
+// Image paths of a directory, or the paths listed line by line in a text file
+vector<string> batch::listSourceImages(const char *source) {
+    vector<string> paths;
+
+    DIR *dirp = opendir(source);
+    if (dirp != NULL) {
+        closedir(dirp);
+        vector<string> names = process::listImageFiles(source);
+        for (int i = 0; i < names.size(); i++) {
+            paths.push_back(string(source) + "/" + names[i]);
+        }
+        return paths;
+    }
+
+    ifstream file(source);
+    if (!file.is_open()) {
+        printf("Cannot open image source %s\n", source);
+        return paths;
+    }
+    string line;
+    while (getline(file, line)) {
+        if (!line.empty() && line[line.size() - 1] == '\r') {
+            line.erase(line.size() - 1);
+        }
+        if (!line.empty()) {
+            paths.push_back(line);
+        }
+    }
+
+    return paths;
+}
+
+// the actual label is the part of the file name before the first '_'
+static string labelFromPath(string &path) {
+    size_t slash = path.find_last_of('/');
+    string name = slash == string::npos ? path : path.substr(slash + 1);
+    return name.substr(0, name.find("_"));
+}
+
+// results of one pass over the images, by image index
+struct BatchPass {
+    vector<string> labels;
+    vector<double> latencies;  // decode to label
+    vector<double> segmentMs;  // analysis only
+    vector<char> loaded;
+    double seconds;            // wall time of the whole pass
+};
+
+// Decode, analyze and classify every image on a pool of workers
+static void runPass(vector<string> &paths, FeatureModel &model, ClassifyConfig &classifier, SegmentConfig &segment,
+                    int numThreads, BatchPass &pass) {
+    pass.labels.assign(paths.size(), string());
+    pass.latencies.assign(paths.size(), 0.0);
+    pass.segmentMs.assign(paths.size(), 0.0);
+    pass.loaded.assign(paths.size(), 0);
+    atomic<int> next(0);
+
+    int64 start = cv::getTickCount();
+
+    vector<thread> workers;
+    for (int t = 0; t < numThreads; t++) {
+        workers.push_back(thread([&]() {
+            // one analysis result per worker, its buffers are reused from image to image
+            ImgData imgData;
+            for (int i = next++; i < paths.size(); i = next++) {
+                int64 imgStart = cv::getTickCount();
+
+                cv::Mat img = cv::imread(paths[i]);
+                if (img.data == NULL) {
+                    cout << "This image " << paths[i] << " cannot be loaded into cv::Mat\n";
+                    continue;
+                }
+
+                int64 segmentStart = cv::getTickCount();
+                image::analyzeImage(img, imgData, segment);
+                pass.segmentMs[i] = (cv::getTickCount() - segmentStart) * 1000.0 / cv::getTickFrequency();
+                // no object found, the features are left from the last image
+                pass.labels[i] = imgData.contour.empty() ? "unknown" : classify::classifyFeature(imgData.features, model, classifier);
+
+                pass.latencies[i] = (cv::getTickCount() - imgStart) * 1000.0 / cv::getTickFrequency();
+                pass.loaded[i] = 1;
+            }
+        }));
+    }
+    for (int t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+
+    pass.seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+}
+
+// Evaluate every image, then report
+int batch::runBatchEvaluation(const char *source, FeatureModel &model, ClassifyConfig &classifier, SegmentConfig &segment,
+                              int numThreads, const char *matrixPath, const char *predictionsPath) {
+    vector<string> paths = batch::listSourceImages(source);
+    if (paths.empty()) {
+        printf("No images to evaluate in %s\n", source);
+        return (-1);
+    }
+    printf("Evaluating %d images from %s with %d threads\n\n", (int)paths.size(), source, numThreads);
+
+    BatchPass pass;
+    runPass(paths, model, classifier, segment, numThreads, pass);
+    double seconds = pass.seconds;
+
+    // pyramid mode is also evaluated at full resolution, to report what the speedup costs;
+    // as a pass of its own after the timed one, so neither competes with the other for the cores
+    bool comparePyramid = segment.pyramidLevels > 0;
+    BatchPass fullPass;
+    if (comparePyramid) {
+        SegmentConfig fullSegment = segment;
+        fullSegment.pyramidLevels = 0;
+        fullSegment.pyramidRefine = false;
+        runPass(paths, model, classifier, fullSegment, numThreads, fullPass);
+    }
+
+    // keep the images that could be evaluated, in source order
+    vector<string> actual, detected, fullDetected;
+    vector<double> evaluatedLatencies, evaluatedSegmentMs, evaluatedFullSegmentMs;
+    ofstream predictions(predictionsPath);
+    predictions << "image,actual,detected,latency_ms\n";
+    for (int i = 0; i < paths.size(); i++) {
+        // an image is compared only if both passes could load it
+        if (!pass.loaded[i] || (comparePyramid && !fullPass.loaded[i])) {
+            continue;
+        }
+        actual.push_back(labelFromPath(paths[i]));
+        detected.push_back(pass.labels[i]);
+        evaluatedLatencies.push_back(pass.latencies[i]);
+        evaluatedSegmentMs.push_back(pass.segmentMs[i]);
+        if (comparePyramid) {
+            fullDetected.push_back(fullPass.labels[i]);
+            evaluatedFullSegmentMs.push_back(fullPass.segmentMs[i]);
+        }
+        predictions << paths[i] << "," << actual.back() << "," << detected.back() << "," << pass.latencies[i] << "\n";
+    }
+    predictions.close();
+
+    if (actual.empty()) {
+        printf("None of the images could be loaded\n");
+        return (-1);
+    }
+
+    process::buildMatrixTable(actual, detected, matrixPath);
+
+    int correct = 0;
+    for (int i = 0; i < actual.size(); i++) {
+        correct += actual[i] == detected[i];
+    }
+
+    printf("\nimages: %d, accuracy: %.2f%%\n", (int)actual.size(), 100.0 * correct / actual.size());
+    printf("throughput: %.2f images/sec\n", actual.size() / seconds);
+    printf("latency per image: p50 %.2f ms, p99 %.2f ms\n", percentile(evaluatedLatencies, 50), percentile(evaluatedLatencies, 99));
+    printf("confusion matrix: %s\npredictions: %s\n", matrixPath, predictionsPath);
+
+    if (comparePyramid) {
+        int fullCorrect = 0, agree = 0;
+        for (int i = 0; i < actual.size(); i++) {
+            fullCorrect += actual[i] == fullDetected[i];
+            agree += detected[i] == fullDetected[i];
+        }
+        printf("\npyramid level %d%s vs full resolution:\n", segment.pyramidLevels, segment.pyramidRefine ? " refined" : "");
+        printf("  accuracy %.2f%% vs %.2f%%, same label for %.2f%% of the images\n",
+               100.0 * correct / actual.size(), 100.0 * fullCorrect / actual.size(), 100.0 * agree / actual.size());
+        printf("  segmentation p50 %.2f ms vs %.2f ms\n", percentile(evaluatedSegmentMs, 50), percentile(evaluatedFullSegmentMs, 50));
+        printf("  throughput %.2f vs %.2f images/sec\n", actual.size() / seconds, actual.size() / fullPass.seconds);
+    }
+
+    return (0);
+}
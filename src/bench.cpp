@@ -0,0 +1,684 @@
+#include "bench.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <opencv2/core/utility.hpp>
+#include <opencv2/opencv.hpp>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "cascade.hpp"
+#include "classify.hpp"
+#include "framesource.hpp"
+#include "image.hpp"
+#include "kdtree.hpp"
+#include "model.hpp"
+#include "process.hpp"
+
+using namespace std;
+
+// milliseconds elapsed since a tick count
+static double elapsedMs(int64 start) {
+    return (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency();
+}
+
+// A model of n scaled rows drawn around one center per label, like the clusters of the real training features
+static FeatureModel syntheticModel(int n, int numLabels, mt19937 &rng) {
+    FeatureModel model;
+    uniform_real_distribution<double> center(0.0, 10.0);
+    normal_distribution<double> noise(0.0, 1.0);
+
+    vector<vector<double>> centers(numLabels, vector<double>(MODEL_DIMS));
+    for (int label = 0; label < numLabels; label++) {
+        model.labels.push_back("label" + to_string(label));
+        model.labelCounts.push_back(0);
+        for (int d = 0; d < MODEL_DIMS; d++) {
+            centers[label][d] = center(rng);
+        }
+    }
+
+    // rows grouped by label, as compileModel lays them out
+    for (int i = 0; i < n; i++) {
+        int label = (int)((long long)i * numLabels / n);
+        model.labelIds.push_back(label);
+        model.labelCounts[label]++;
+        for (int d = 0; d < MODEL_DIMS; d++) {
+            model.cols[d].push_back(centers[label][d] + noise(rng));
+        }
+    }
+    for (int d = 0; d < MODEL_DIMS; d++) {
+        model.scale[d] = 1.0;
+    }
+    model.numRows = n;
+
+    return model;
+}
+
+int bench::benchIndex() {
+    const int k = 8;
+    const int sizes[] = {1000, 10000, 1000000};
+    const double epsList[] = {0.0, 0.5, 1.0, 2.0};
+
+    mt19937 rng(5330);
+    printf("%10s %-14s %10s %12s %8s\n", "references", "search", "build ms", "query us", "recall");
+
+    for (int n : sizes) {
+        FeatureModel model = syntheticModel(n, 100, rng);
+
+        // queries around random training rows
+        int numQueries = n >= 1000000 ? 200 : 1000;
+        uniform_int_distribution<int> pick(0, n - 1);
+        normal_distribution<double> noise(0.0, 0.5);
+        vector<double> queries((size_t)numQueries * MODEL_DIMS);
+        for (int q = 0; q < numQueries; q++) {
+            int row = pick(rng);
+            for (int d = 0; d < MODEL_DIMS; d++) {
+                queries[(size_t)q * MODEL_DIMS + d] = model.cols[d][row] + noise(rng);
+            }
+        }
+
+        // brute force, also the ground truth for recall
+        vector<vector<int>> truth(numQueries);
+        vector<pair<double, int>> nearest;
+        int64 start = cv::getTickCount();
+        for (int q = 0; q < numQueries; q++) {
+            model::nearestRows(model, &queries[(size_t)q * MODEL_DIMS], k, nearest);
+            for (auto &p : nearest) {
+                truth[q].push_back(p.second);
+            }
+        }
+        printf("%10d %-14s %10s %12.2f %8.3f\n", n, "brute force", "-", elapsedMs(start) * 1000.0 / numQueries, 1.0);
+
+        for (double eps : epsList) {
+            start = cv::getTickCount();
+            model::buildIndex(model, eps);
+            double buildMs = elapsedMs(start);
+
+            int found = 0;
+            start = cv::getTickCount();
+            for (int q = 0; q < numQueries; q++) {
+                model::nearestRows(model, &queries[(size_t)q * MODEL_DIMS], k, nearest);
+                for (auto &p : nearest) {
+                    found += count(truth[q].begin(), truth[q].end(), p.second);
+                }
+            }
+            double queryUs = elapsedMs(start) * 1000.0 / numQueries;
+
+            string name = "kd-tree e=" + to_string(eps).substr(0, 3);
+            printf("%10d %-14s %10.1f %12.2f %8.3f\n", n, name.c_str(), buildMs, queryUs, (double)found / (numQueries * k));
+        }
+        model.index.reset();
+    }
+
+    return 0;
+}
+
+// A feature db of n features drawn around one center per label, and queries around random training features
+static void syntheticDb(int n, int numLabels, int numQueries, mt19937 &rng, map<string, vector<Feature>> &db, vector<Feature> &queries) {
+    uniform_real_distribution<double> center(0.1, 1.0), huCenter(0.0, 0.01);
+    normal_distribution<double> noise(0.0, 0.05), huNoise(0.0, 0.001);
+
+    vector<Feature> centers(numLabels);
+    for (Feature &c : centers) {
+        c.fillRatio = center(rng);
+        c.bboxDimRatio = center(rng);
+        c.axisDimRatio = center(rng);
+        for (int i = 0; i < NUM_HU_MOMENTS; i++) {
+            c.huMoments.push_back(huCenter(rng));
+        }
+    }
+
+    auto around = [&](const Feature &c, double spread) {
+        Feature f;
+        f.fillRatio = c.fillRatio + spread * noise(rng);
+        f.bboxDimRatio = c.bboxDimRatio + spread * noise(rng);
+        f.axisDimRatio = c.axisDimRatio + spread * noise(rng);
+        for (int i = 0; i < NUM_HU_MOMENTS; i++) {
+            f.huMoments.push_back(c.huMoments[i] + spread * huNoise(rng));
+        }
+        return f;
+    };
+
+    db.clear();
+    vector<Feature *> rows;
+    for (int i = 0; i < n; i++) {
+        int label = (int)((long long)i * numLabels / n);
+        db["label" + to_string(label)].push_back(around(centers[label], 1.0));
+    }
+    for (auto &entry : db) {
+        for (Feature &f : entry.second) {
+            rows.push_back(&f);
+        }
+    }
+
+    uniform_int_distribution<int> pick(0, n - 1);
+    queries.clear();
+    for (int q = 0; q < numQueries; q++) {
+        queries.push_back(around(*rows[pick(rng)], 0.5));
+    }
+}
+
+// The compiled model against the legacy classifiers over the feature map, nearest mean & KNN on the same queries: label mismatches,
+// and the largest difference of the distances they compare: the label averages for nearest mean, the row distances for KNN,
+// which only differ in rounding
+int bench::benchClassify() {
+    const int sizes[] = {140, 14000, 140000};
+    const double maxDist = 1000;
+    const int k = 8;
+
+    mt19937 rng(5330);
+    printf("%8s %-6s %8s %12s %12s %12s %10s\n", "rows", "method", "queries", "max diff", "legacy us", "model us", "mismatch");
+    for (int n : sizes) {
+        int numQueries = n >= 100000 ? 20 : n >= 10000 ? 200 : 1000;
+        map<string, vector<Feature>> db;
+        vector<Feature> queries;
+        syntheticDb(n, 7, numQueries, rng, db, queries);
+
+        FeatureStats stats;
+        for (auto &entry : db) {
+            for (Feature &f : entry.second) {
+                classify::addFeature(stats, f);
+            }
+        }
+        Feature stdDev = classify::featureStdDev(stats);
+        FeatureModel model = model::compileModel(db, stdDev);
+
+        // the kernel's distance to every row, against euclideanDist in the same row order
+        double distDiff = 0.0;
+        vector<double> dists(model.numRows);
+        for (Feature &q : queries) {
+            double query[MODEL_DIMS];
+            model::scaleFeature(model, q, query);
+            model::distances(model, query, dists.data());
+            int row = 0;
+            for (auto &entry : db) {
+                for (Feature &f : entry.second) {
+                    distDiff = max(distDiff, fabs(dists[row++] - classify::euclideanDist(q, f, stdDev)));
+                }
+            }
+        }
+
+        // the per-label averages of the running sums, against those of the scan in classifyObject
+        double meanDiff = 0.0;
+        vector<double> means(model.labels.size());
+        for (Feature &q : queries) {
+            double query[MODEL_DIMS];
+            model::scaleFeature(model, q, query);
+            model::meanDistances(model, query, means.data());
+            int label = 0;
+            for (auto &entry : db) {
+                double dist = 0.0;
+                for (Feature &f : entry.second) {
+                    dist += classify::euclideanDist(q, f, stdDev);
+                }
+                meanDiff = max(meanDiff, fabs(means[label++] - dist / entry.second.size()));
+            }
+        }
+
+        // both classifiers of a method on every query, timed separately
+        auto compare = [&](const char *method, double diff, function<string(Feature &)> legacy, function<string(Feature &)> compiled) {
+            vector<string> expected(numQueries), actual(numQueries);
+            int64 start = cv::getTickCount();
+            for (int q = 0; q < numQueries; q++) {
+                expected[q] = legacy(queries[q]);
+            }
+            double legacyUs = elapsedMs(start) * 1000.0 / numQueries;
+            start = cv::getTickCount();
+            for (int q = 0; q < numQueries; q++) {
+                actual[q] = compiled(queries[q]);
+            }
+            double modelUs = elapsedMs(start) * 1000.0 / numQueries;
+
+            int mismatch = 0;
+            for (int q = 0; q < numQueries; q++) {
+                mismatch += expected[q] != actual[q];
+            }
+            printf("%8d %-6s %8d %12.3g %12.2f %12.2f %10d\n", n, method, numQueries, diff, legacyUs, modelUs, mismatch);
+        };
+        compare("mean", meanDiff, [&](Feature &q) { return classify::classifyObject(q, db, stdDev, maxDist); },
+                [&](Feature &q) { return model::classifyNearestMean(model, q, maxDist); });
+        compare("knn", distDiff, [&](Feature &q) { return classify::classifyObjectByKNN(q, db, stdDev, k, maxDist); },
+                [&](Feature &q) { return model::classifyKNN(model, q, k, maxDist); });
+    }
+
+    return 0;
+}
+
+// average milliseconds of a run over reps repetitions, after one warm-up
+template <typename F>
+static double timeMs(int reps, F run) {
+    run();
+    int64 start = cv::getTickCount();
+    for (int i = 0; i < reps; i++) {
+        run();
+    }
+    return elapsedMs(start) / reps;
+}
+
+int bench::benchBlur() {
+    const Size sizes[] = {Size(640, 480), Size(1920, 1080), Size(3840, 2160)};
+
+    printf("%10s %14s %14s %14s %10s\n", "size", "reference ms", "blur5x5 ms", "Gaussian ms", "mismatch");
+    for (const Size &size : sizes) {
+        Mat src(size, CV_8UC3);
+        cv::randu(src, Scalar::all(0), Scalar::all(256));
+        Mat expected, actual, gaussian;
+
+        double referenceMs = timeMs(1, [&]() { image::blur5x5Reference(src, expected); });
+        double blurMs = timeMs(20, [&]() { image::blur5x5(src, actual); });
+        double gaussianMs = timeMs(20, [&]() { cv::GaussianBlur(src, gaussian, Size(5, 5), 0); });
+
+        // bytes that differ from the reference, 0 when bit-exact
+        Mat diff;
+        cv::absdiff(expected, actual, diff);
+        int mismatch = cv::countNonZero(diff.reshape(1));
+
+        string name = to_string(size.width) + "x" + to_string(size.height);
+        printf("%10s %14.2f %14.3f %14.3f %10d\n", name.c_str(), referenceMs, blurMs, gaussianMs, mismatch);
+    }
+
+    return 0;
+}
+
+int bench::benchThreshold() {
+    const Size sizes[] = {Size(1920, 1080), Size(3840, 2160)};
+    const int closeList[] = {0, 5};
+    const string methods[] = {"fixed", "otsu", "isodata"};
+
+    mt19937 rng(5330);
+    printf("%10s %-8s %6s %14s %14s %10s\n", "size", "method", "close", "separate ms", "fused ms", "mismatch");
+    for (const Size &size : sizes) {
+        // dark blobs on a light background, so the closing has holes to fill
+        Mat src(size, CV_8UC3, Scalar(200, 200, 200));
+        uniform_int_distribution<int> x(0, size.width - 1), y(0, size.height - 1), r(10, 200);
+        for (int i = 0; i < 40; i++) {
+            cv::circle(src, Point(x(rng), y(rng)), r(rng), Scalar(40, 40, 40), -1);
+        }
+        Mat noise(size, CV_8UC3);
+        cv::randu(noise, Scalar::all(0), Scalar::all(120));
+        cv::subtract(src, noise, src);
+
+        // the histogram methods take the fused path's second pass over the shared blurred image
+        for (const string &method : methods) {
+            SegmentConfig config;
+            config.thresholdMethod = method;
+            for (int closeIterations : closeList) {
+                Mat expected, actual;
+                int separateThreshold = 0, fusedThreshold = 0;
+                double separateMs = timeMs(10, [&]() {
+                    expected = image::thresholdImageAuto(src, config, separateThreshold);
+                    if (closeIterations > 0) {
+                        expected = image::cleanUpBinary(expected, closeIterations);
+                    }
+                });
+                double fusedMs = timeMs(10, [&]() { actual = image::thresholdImageFused(src, config.threshold, closeIterations, method, &fusedThreshold); });
+
+                Mat diff;
+                cv::absdiff(expected, actual, diff);
+                string name = to_string(size.width) + "x" + to_string(size.height);
+                printf("%10s %-8s %6d %14.3f %14.3f %10d%s\n", name.c_str(), method.c_str(), closeIterations, separateMs, fusedMs,
+                       cv::countNonZero(diff), separateThreshold != fusedThreshold ? " (threshold differs)" : "");
+            }
+        }
+    }
+
+    return 0;
+}
+
+// The test images scaled to 1080p, as a stand-in for camera frames
+static vector<Mat> testFrames(int maxFrames) {
+    const char *dirname = "../data/testing";
+    vector<Mat> frames;
+    for (const string &name : process::listImageFiles(dirname)) {
+        Mat img = cv::imread(string(dirname) + "/" + name);
+        if (!img.empty() && frames.size() < maxFrames) {
+            cv::resize(img, img, Size(1920, 1080));
+            frames.push_back(img);
+        }
+    }
+    if (frames.empty()) {
+        printf("No frames in %s\n", dirname);
+    }
+    return frames;
+}
+
+// The per-pixel colored regions image of the first calculateImgData, built on every frame
+static Mat legacyColorRegions(Mat &labelImage, int nLabels) {
+    vector<Vec3b> colors(nLabels);
+    colors[0] = Vec3b(0, 0, 0);
+    for (int label = 1; label < nLabels; ++label) {
+        colors[label] = Vec3b((rand() & 255), (rand() & 255), (rand() & 255));
+    }
+    Mat dst(labelImage.size(), CV_8UC3);
+    for (int r = 0; r < dst.rows; ++r) {
+        for (int c = 0; c < dst.cols; ++c) {
+            dst.at<Vec3b>(r, c) = colors[labelImage.at<int>(r, c)];
+        }
+    }
+    return dst;
+}
+
+// The first calculateImgData, as the baseline: the frame is thresholded once for the result and again for the
+// connected components, the regions are colored on every frame, and the contours search a '> 0' copy
+static void legacyImgData(Mat &src, StageTimer &timer) {
+    timer.begin();
+    Mat thresholded = image::thresholdImage(src);
+    timer.lap("threshold");
+
+    Mat components = image::thresholdImage(src);
+    Mat labelImage(components.size(), CV_32S);
+    int nLabels = cv::connectedComponents(components, labelImage, 8);
+    Mat regions = legacyColorRegions(labelImage, nLabels);
+    timer.lap("components");
+
+    vector<vector<Point>> contours;
+    Mat thres = thresholded > 0;
+    cv::findContours(thres, contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE);
+    timer.lap("contours");
+
+    if (!contours.empty()) {
+        int maxIdx = 0;
+        for (int i = 0; i < contours.size(); i++) {
+            if (contours[i].size() >= contours[maxIdx].size())
+                maxIdx = i;
+        }
+        RotatedRect bbox;
+        vector<Point> axes;
+        image::calculateFeatures(regions, contours, maxIdx, bbox, axes);
+    }
+    timer.lap("features");
+}
+
+// average milliseconds of a stage of a timer, 0 if it never ran
+static double stageMs(StageTimer &timer, const string &stage) {
+    for (int i = 0; i < timer.stages.size(); i++) {
+        if (timer.stages[i] == stage) {
+            return timer.totalMs[i] / timer.counts[i];
+        }
+    }
+    return 0.0;
+}
+
+int bench::benchSegment() {
+    vector<Mat> images = testFrames(20);
+    if (images.empty()) {
+        return (-1);
+    }
+    const Size sizes[] = {Size(640, 480), Size(1920, 1080), Size(3840, 2160)};
+    const string stages[] = {"threshold", "components", "contours", "features", "debug"};
+
+    for (const Size &size : sizes) {
+        vector<Mat> frames(images.size());
+        for (size_t i = 0; i < images.size(); i++) {
+            cv::resize(images[i], frames[i], size);
+        }
+
+        // the baseline, what video mode runs on every frame, and what it adds when the images are kept for display
+        StageTimer timers[3];
+        legacyImgData(frames[0], timers[0]);
+        timers[0].reset();
+        for (int mode = 1; mode < 3; mode++) {
+            SegmentConfig config;
+            config.withDebug = mode == 2;
+            config.withRegions = mode == 2;
+            ImgData res;
+            image::analyzeImage(frames[0], res, config);
+            for (int rep = 0; rep < 5; rep++) {
+                for (Mat &frame : frames) {
+                    image::analyzeImage(frame, res, config, &timers[mode]);
+                }
+            }
+        }
+        for (int rep = 0; rep < 5; rep++) {
+            for (Mat &frame : frames) {
+                legacyImgData(frame, timers[0]);
+            }
+        }
+
+        printf("segment %dx%d, ms per frame\n", size.width, size.height);
+        printf("  %-12s %10s %10s %14s\n", "stage", "legacy", "current", "with regions");
+        double totals[3] = {0.0, 0.0, 0.0};
+        for (const string &stage : stages) {
+            double ms[3];
+            for (int t = 0; t < 3; t++) {
+                ms[t] = stageMs(timers[t], stage);
+                totals[t] += ms[t];
+            }
+            printf("  %-12s %10.3f %10.3f %14.3f\n", stage.c_str(), ms[0], ms[1], ms[2]);
+        }
+        printf("  %-12s %10.3f %10.3f %14.3f\n", "total", totals[0], totals[1], totals[2]);
+    }
+
+    return 0;
+}
+
+int bench::benchCascade() {
+    vector<Mat> frames = testFrames(20);
+    if (frames.empty()) {
+        return (-1);
+    }
+
+    CascadeConfig config;
+    vector<string> models = {"frontalface_alt", "profileface", "smile", "upperbody", "fullbody", "frontalcatface"};
+    vector<string> engineModels = cascade::configModels(config);
+    CascadeLibrary library;
+    if (cascade::loadLibrary(library, engineModels) != 0 || cascade::loadLibrary(library, models) != 0) {
+        return (-1);
+    }
+    CascadeEngine engine;
+    if (cascade::loadEngine(engine, config, library) != 0) {
+        return (-1);
+    }
+
+    // the original detectAndDisplay: full resolution, default parameters, eyes over every face on one thread
+    const int reps = 3;
+    size_t faceCount = 0;
+    double originalMs = timeMs(reps, [&]() {
+        faceCount = 0;
+        Mat gray;
+        vector<Rect> faces, eyes;
+        for (Mat &frame : frames) {
+            cv::cvtColor(frame, gray, COLOR_BGR2GRAY);
+            cv::equalizeHist(gray, gray);
+            engine.face.detectMultiScale(gray, faces);
+            for (Rect &face : faces) {
+                engine.eyes[0].detectMultiScale(gray(face), eyes);
+            }
+            faceCount += faces.size();
+        }
+    });
+    printf("%-28s %12s %8s\n", "1080p cascade", "ms / frame", "faces");
+    printf("%-28s %12.2f %8zu\n", "original", originalMs / frames.size(), faceCount / frames.size());
+
+    const double scales[] = {1.0, 0.5, 0.33};
+    const int everyList[] = {1, 3};
+    vector<FaceDetection> faces;
+    for (double scale : scales) {
+        for (int every : everyList) {
+            config.detectScale = scale;
+            config.detectEvery = every;
+            double ms = timeMs(reps, [&]() {
+                faceCount = 0;
+                // every frame is fed several times, like a camera looking at a still scene
+                for (Mat &frame : frames) {
+                    for (int i = 0; i < every; i++) {
+                        cascade::detectFaces(engine, frame, config, faces);
+                        faceCount += faces.size();
+                    }
+                }
+            });
+            string name = "scale " + to_string(scale).substr(0, 4) + ", every " + to_string(every);
+            printf("%-28s %12.2f %8zu\n", name.c_str(), ms / (frames.size() * every), faceCount / (frames.size() * every));
+        }
+    }
+
+    // several models over the same frames: one independent pass each, against the registry's shared frame
+    CascadeRegistry registry;
+    if (cascade::loadRegistry(registry, models, library) != 0) {
+        return (-1);
+    }
+    config.detectScale = 0.5;
+    size_t hitCount = 0;
+    double independentMs = timeMs(1, [&]() {
+        hitCount = 0;
+        Mat gray, small;
+        vector<Rect> found;
+        for (Mat &frame : frames) {
+            for (CascadeClassifier &classifier : registry.classifiers) {
+                cv::cvtColor(frame, gray, COLOR_BGR2GRAY);
+                cv::resize(gray, small, Size(), config.detectScale, config.detectScale, INTER_AREA);
+                cv::equalizeHist(small, small);
+                classifier.detectMultiScale(small, found, config.scaleFactor, config.minNeighbors);
+                hitCount += found.size();
+            }
+        }
+    });
+    size_t independentHits = hitCount;
+    vector<CascadeHit> hits;
+    double sharedMs = timeMs(1, [&]() {
+        hitCount = 0;
+        for (Mat &frame : frames) {
+            cascade::detectAll(registry, frame, config, hits);
+            hitCount += hits.size();
+        }
+    });
+    printf("\n%-28s %12s %8s\n", "1080p, 6 models", "ms / frame", "hits");
+    printf("%-28s %12.2f %8zu\n", "independent passes", independentMs / frames.size(), independentHits / frames.size());
+    printf("%-28s %12.2f %8zu\n", "registry", sharedMs / frames.size(), hitCount / frames.size());
+
+    return 0;
+}
+
+// Decode the first frames of every recording, so that decoding is not part of the measure;
+// the test images stand in for one recording if none is given
+static vector<vector<Mat>> loadRecordings(vector<string> &videos, int maxFrames) {
+    vector<vector<Mat>> recordings;
+    SourceConfig sourceConfig;
+    sourceConfig.maxFrames = maxFrames;
+    for (const string &path : videos) {
+        FrameSource source;
+        if (!framesource::open(source, path, sourceConfig)) {
+            printf("Unable to open video source %s\n", path.c_str());
+            continue;
+        }
+        vector<Mat> frames;
+        Mat frame;
+        while (framesource::read(source, frame)) {
+            frames.push_back(frame.clone());
+        }
+        if (!frames.empty()) {
+            recordings.push_back(frames);
+        }
+    }
+
+    if (videos.empty()) {
+        vector<Mat> frames = testFrames(maxFrames);
+        if (!frames.empty()) {
+            recordings.push_back(frames);
+        }
+    }
+    return recordings;
+}
+
+int bench::benchStreams(vector<string> &videos) {
+    vector<vector<Mat>> recordings = loadRecordings(videos, 100);
+    if (recordings.empty()) {
+        return (-1);
+    }
+
+    CascadeConfig config;
+    CascadeLibrary library;
+    vector<string> models = cascade::configModels(config);
+    if (cascade::loadLibrary(library, models) != 0) {
+        return (-1);
+    }
+
+    // every stream runs on one core, so the scaling measured is that of the streams alone
+    int poolThreads = cv::getNumThreads();
+    cv::setNumThreads(1);
+
+    int maxStreams = max(1, (int)thread::hardware_concurrency());
+    vector<int> streamCounts;
+    for (int n = 1; n < maxStreams; n *= 2) {
+        streamCounts.push_back(n);
+    }
+    streamCounts.push_back(maxStreams);
+
+    const int rounds = 2;
+    double singleFps = 0;
+    printf("%d recordings, cascade engine at its default settings\n", (int)recordings.size());
+    printf("%8s %12s %12s %10s\n", "streams", "frames / s", "per stream", "scaling");
+    for (int numStreams : streamCounts) {
+        // one engine per stream, cloned from the shared library
+        vector<CascadeEngine> engines(numStreams);
+        for (int i = 0; i < numStreams; i++) {
+            if (cascade::loadEngine(engines[i], config, library) != 0) {
+                cv::setNumThreads(poolThreads);
+                return (-1);
+            }
+        }
+
+        atomic<long long> frameCount(0);
+        int64 start = cv::getTickCount();
+        vector<thread> streams;
+        for (int i = 0; i < numStreams; i++) {
+            streams.push_back(thread([&, i]() {
+                vector<Mat> &frames = recordings[i % recordings.size()];
+                vector<FaceDetection> faces;
+                for (int r = 0; r < rounds; r++) {
+                    for (Mat &frame : frames) {
+                        cascade::detectFaces(engines[i], frame, config, faces);
+                    }
+                }
+                frameCount += rounds * frames.size();
+            }));
+        }
+        for (thread &t : streams) {
+            t.join();
+        }
+
+        double fps = frameCount / (elapsedMs(start) / 1000.0);
+        if (numStreams == 1) {
+            singleFps = fps;
+        }
+        printf("%8d %12.1f %12.1f %10.2f\n", numStreams, fps, fps / numStreams, fps / (singleFps * numStreams));
+    }
+
+    cv::setNumThreads(poolThreads);
+    return 0;
+}
+
+// Dispatch a benchmark by name
+int bench::runBenchmark(string &name, vector<string> &inputs) {
+    if (name == "index") {
+        return bench::benchIndex();
+    }
+    if (name == "classify") {
+        return bench::benchClassify();
+    }
+    if (name == "blur") {
+        return bench::benchBlur();
+    }
+    if (name == "threshold") {
+        return bench::benchThreshold();
+    }
+    if (name == "segment") {
+        return bench::benchSegment();
+    }
+
+    if (name == "cascade") {
+        return bench::benchCascade();
+    }
+
+    if (name == "streams") {
+        return bench::benchStreams(inputs);
+    }
+
+    printf("Unknown benchmark %s, available: index, classify, blur, threshold, segment, cascade, streams\n", name.c_str());
+    return (-1);
+}
@@ -1,5 +1,13 @@
 #include "cascade.hpp"
 
+#include <dirent.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+
+#include "opencv2/core/utility.hpp"
 #include "opencv2/highgui.hpp"
 #include "opencv2/imgproc.hpp"
 #include "opencv2/objdetect.hpp"
@@ -7,95 +15,438 @@
 
 using namespace cascade;
 
-CascadeClassifier face_cascade;
-CascadeClassifier eyes_cascade;
+// list the cascade files in a directory, sorted by name
+vector<string> cascade::listCascades(const char *dirname) {
+    vector<string> names;
+    DIR *dirp = opendir(dirname);
+    if (dirp == NULL) {
+        printf("Cannot open directory %s\n", dirname);
+        return names;
+    }
 
-// process the video stream
-// reference OpenCV: https://docs.opencv.org/3.4/db/d28/tutorial_cascade_classifier.html
-int cascade::cascadeVideoStream() {
-    string face = samples::findFile("../data/haarcascades/haarcascade_frontalface_alt.xml");
-    string eyes = samples::findFile("../data/haarcascades/haarcascade_eye_tree_eyeglasses.xml");
+    struct dirent *dp;
+    while ((dp = readdir(dirp)) != NULL) {
+        string name = dp->d_name;
+        // haarcascade_<name>.xml
+        if (name.size() > 16 && name.compare(0, 12, "haarcascade_") == 0 && name.compare(name.size() - 4, 4, ".xml") == 0) {
+            names.push_back(name.substr(12, name.size() - 16));
+        }
+    }
+    closedir(dirp);
+
+    sort(names.begin(), names.end());
+    return names;
+}
+
+vector<string> cascade::configModels(CascadeConfig &config) {
+    if (!config.models.empty()) {
+        return config.models;
+    }
+    vector<string> names = {FACE_MODEL};
+    if (config.eyes) {
+        names.push_back(EYES_MODEL);
+    }
+    return names;
+}
+
+static string cascadePath(const string &dirname, const string &name) {
+    return dirname + "/haarcascade_" + name + ".xml";
+}
 
-    if (!face_cascade.load(face)) {
-        cout << "face cascade cannot be loaded\n";
+// Read the cascade files once; parsing is left to every clone
+int cascade::loadLibrary(CascadeLibrary &library, vector<string> &names, const char *dirname) {
+    library.dirname = dirname;
+    for (const string &name : names) {
+        vector<string> expanded = name == "all" ? cascade::listCascades(dirname) : vector<string>(1, name);
+        for (const string &model : expanded) {
+            if (library.files.count(model)) {
+                continue;
+            }
+            string path = cascadePath(library.dirname, model);
+            ifstream file(path.c_str(), ios::binary);
+            if (!file) {
+                printf("Cascade %s cannot be read from %s\n", model.c_str(), path.c_str());
+                return -1;
+            }
+            library.files[model].assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        }
+    }
+
+    return 0;
+}
+
+// Parse a model from the text in memory. The library is only read, so any number of threads may clone at once.
+// Cascades of the old Haar format are only understood by CascadeClassifier::load, so they are loaded from the file.
+int cascade::cloneClassifier(const CascadeLibrary &library, const string &name, CascadeClassifier &classifier) {
+    map<string, string>::const_iterator it = library.files.find(name);
+    if (it == library.files.end()) {
+        printf("Cascade %s is not loaded\n", name.c_str());
         return -1;
     }
-    if (!eyes_cascade.load(eyes)) {
-        cout << "eyes cascade cannot be loaded\n";
+
+    FileStorage fs(it->second, FileStorage::READ | FileStorage::MEMORY);
+    if (fs.isOpened() && classifier.read(fs.getFirstTopLevelNode())) {
+        return 0;
+    }
+    if (classifier.load(cascadePath(library.dirname, name))) {
+        return 0;
+    }
+
+    printf("Cascade %s cannot be parsed\n", name.c_str());
+    return -1;
+}
+
+// Clone the face cascade, and one eye cascade per worker thread
+// reference OpenCV: https://docs.opencv.org/3.4/db/d28/tutorial_cascade_classifier.html
+int cascade::loadEngine(CascadeEngine &engine, CascadeConfig &config, const CascadeLibrary &library) {
+    if (cascade::cloneClassifier(library, FACE_MODEL, engine.face) != 0) {
         return -1;
     }
 
-    cout << "\nStart video mode\n";
-    // process::classifyObjectByVideo(db, standardFeature);
-    cv::VideoCapture *capdev;
+    engine.eyes.clear();
+    if (config.eyes) {
+        engine.eyes.resize(max(1, cv::getNumThreads()));
+        for (size_t i = 0; i < engine.eyes.size(); i++) {
+            if (cascade::cloneClassifier(library, EYES_MODEL, engine.eyes[i]) != 0) {
+                return -1;
+            }
+        }
+    }
 
-    // open the video device
-    capdev = new cv::VideoCapture(0);
-    if (!capdev->isOpened()) {
-        printf("Unable to open video device\n");
-        return (-1);
+    return 0;
+}
+
+// a rectangle of the detection image in frame pixels
+static Rect toFrame(const Rect &r, double scale) {
+    return Rect(cvRound(r.x / scale), cvRound(r.y / scale), cvRound(r.width / scale), cvRound(r.height / scale));
+}
+
+// The gray frame resized by the detection scale & equalized, what every cascade searches.
+// Equalizing after the resize is cheaper, and the buffers are kept for the next frame.
+static Mat &searchImage(Mat &frame, double scale, Mat &gray, Mat &small) {
+    cv::cvtColor(frame, gray, COLOR_BGR2GRAY);
+    Mat &search = scale < 1.0 ? small : gray;
+    if (scale < 1.0) {
+        Size size(max(1, cvRound(frame.cols * scale)), max(1, cvRound(frame.rows * scale)));
+        cv::resize(gray, small, size, 0, 0, INTER_AREA);
     }
+    cv::equalizeHist(search, search);
+    return search;
+}
 
-    // get some properties of the image
-    cv::Size refS((int)capdev->get(cv::CAP_PROP_FRAME_WIDTH),
-                  (int)capdev->get(cv::CAP_PROP_FRAME_HEIGHT));
-    printf("Expected size: %d %d\n", refS.width, refS.height);
+static Point center(const Rect &r) {
+    return Point(r.x + r.width / 2, r.y + r.height / 2);
+}
 
-    cv::Mat frame;
-    for (;;) {
-        *capdev >> frame;  // get a new frame from the camera, treat as a stream
-        if (frame.empty()) {
-            printf("frame is empty\n");
-            break;
+// fold a box into an FNV-1a digest, so runs can be compared by their detections
+static void hashRect(unsigned long long &digest, const Rect &r) {
+    int values[4] = {r.x, r.y, r.width, r.height};
+    const unsigned char *bytes = (const unsigned char *)values;
+    for (size_t i = 0; i < sizeof(values); i++) {
+        digest = (digest ^ bytes[i]) * 1099511628211ULL;
+    }
+}
+
+// Move the faces of the last detection along their motion since the detection before,
+// a face that was not seen then stays where it is
+static void extrapolateFaces(CascadeEngine &engine, long long frameIndex, vector<FaceDetection> &faces) {
+    faces = engine.last;
+    if (engine.previousFrame < 0) {
+        return;
+    }
+    double t = (double)(frameIndex - engine.lastFrame) / (engine.lastFrame - engine.previousFrame);
+
+    for (FaceDetection &f : faces) {
+        Point c = center(f.face);
+
+        // the same face in the previous detection: the nearest one that moved less than its size
+        const FaceDetection *match = NULL;
+        double best = f.face.width;
+        for (const FaceDetection &p : engine.previous) {
+            double dist = cv::norm(center(p.face) - c);
+            if (dist < best) {
+                best = dist;
+                match = &p;
+            }
+        }
+        if (match == NULL) {
+            continue;
         }
 
-        cascade::detectAndDisplay(frame);
+        Point pc = center(match->face);
+        Point shift(cvRound((c.x - pc.x) * t), cvRound((c.y - pc.y) * t));
+        int width = max(1, cvRound(f.face.width + (f.face.width - match->face.width) * t));
+        int height = max(1, cvRound(f.face.height + (f.face.height - match->face.height) * t));
+        // the eyes keep their place within the face: scaled about its centre, then moved with it
+        double sx = (double)width / f.face.width, sy = (double)height / f.face.height;
+        f.face = Rect(c.x + shift.x - width / 2, c.y + shift.y - height / 2, width, height);
+        for (Rect &eye : f.eyes) {
+            Point ec = center(eye);
+            int eyeWidth = max(1, cvRound(eye.width * sx));
+            int eyeHeight = max(1, cvRound(eye.height * sy));
+            Point moved(c.x + shift.x + cvRound((ec.x - c.x) * sx), c.y + shift.y + cvRound((ec.y - c.y) * sy));
+            eye = Rect(moved.x - eyeWidth / 2, moved.y - eyeHeight / 2, eyeWidth, eyeHeight);
+        }
+    }
+}
 
-        if (cv::waitKey(10) == 'q') {
-            break;
+// Detect the faces, and their eyes, of the next frame of a stream.
+// The search runs on a downscaled copy equalized after the resize, which is several times cheaper than the full frame;
+// the size limits skip the scales that cannot hold a face, and eyes are only searched in the upper part of each face,
+// one face per worker. Between detected frames the faces are extrapolated.
+void cascade::detectFaces(CascadeEngine &engine, Mat &frame, CascadeConfig &config, vector<FaceDetection> &faces) {
+    long long frameIndex = engine.frameIndex++;
+    if (engine.lastFrame >= 0 && frameIndex - engine.lastFrame < max(1, config.detectEvery)) {
+        extrapolateFaces(engine, frameIndex, faces);
+        return;
+    }
+
+    double scale = min(1.0, config.detectScale);
+    Mat &search = searchImage(frame, scale, engine.gray, engine.small);
+
+    // faces
+    vector<Rect> found;
+    int minFace = cvRound(config.minFace * scale);
+    int maxFace = cvRound(config.maxFace * scale);
+    engine.face.detectMultiScale(search, found, config.scaleFactor, config.minNeighbors, 0,
+                                 Size(minFace, minFace), config.maxFace > 0 ? Size(maxFace, maxFace) : Size());
+
+    faces.resize(found.size());
+    for (size_t i = 0; i < found.size(); i++) {
+        faces[i].face = toFrame(found[i], scale);
+        faces[i].eyes.clear();
+    }
+
+    // eyes, each worker searches every workers-th face with its own classifier
+    if (config.eyes && !found.empty() && !engine.eyes.empty()) {
+        int workers = (int)min(engine.eyes.size(), found.size());
+        cv::parallel_for_(Range(0, workers), [&](const Range &range) {
+            vector<Rect> eyes;
+            for (int w = range.start; w < range.end; w++) {
+                for (size_t i = w; i < found.size(); i += workers) {
+                    // the eyes lie in the upper 3/5 of the face
+                    Rect area = Rect(found[i].x, found[i].y, found[i].width, found[i].height * 3 / 5) & Rect(0, 0, search.cols, search.rows);
+                    if (area.empty()) {
+                        continue;
+                    }
+                    int minEye = max(1, area.width / 8);
+                    int maxEye = max(minEye, area.width / 2);
+                    engine.eyes[w].detectMultiScale(search(area), eyes, 1.1, 3, 0, Size(minEye, minEye), Size(maxEye, maxEye));
+
+                    for (size_t j = 0; j < eyes.size(); j++) {
+                        faces[i].eyes.push_back(toFrame(eyes[j] + area.tl(), scale));
+                    }
+                }
+            }
+        });
+    }
+
+    engine.previous.swap(engine.last);
+    engine.previousFrame = engine.lastFrame;
+    engine.last = faces;
+    engine.lastFrame = frameIndex;
+}
+
+// Draw an ellipse on every face, and a circle on every eye
+void cascade::drawFaces(Mat &frame, vector<FaceDetection> &faces) {
+    for (size_t i = 0; i < faces.size(); i++) {
+        Rect &face = faces[i].face;
+        cv::ellipse(frame, center(face), Size(face.width / 2, face.height / 2), 0, 0, 360, Scalar(255, 153, 51), 2);
+
+        for (size_t j = 0; j < faces[i].eyes.size(); j++) {
+            Rect &eye = faces[i].eyes[j];
+            int r = cvRound((eye.width + eye.height) / 4.0);
+            cv::circle(frame, center(eye), r, Scalar(0, 255, 255), 2);
         }
     }
+}
 
-    delete capdev;
+// Clone the named cascades
+int cascade::loadRegistry(CascadeRegistry &registry, vector<string> &names, const CascadeLibrary &library) {
+    registry.names.clear();
+    for (const string &name : names) {
+        if (name == "all") {
+            vector<string> all = cascade::listCascades(library.dirname.c_str());
+            registry.names.insert(registry.names.end(), all.begin(), all.end());
+        } else {
+            registry.names.push_back(name);
+        }
+    }
+
+    registry.classifiers.clear();
+    registry.classifiers.resize(registry.names.size());
+    registry.found.resize(registry.names.size());
+    for (size_t i = 0; i < registry.names.size(); i++) {
+        if (cascade::cloneClassifier(library, registry.names[i], registry.classifiers[i]) != 0) {
+            return -1;
+        }
+    }
 
     return 0;
 }
 
-// apply Haar Cascade detection to the identify face and eyes in the frame
+// Run every cascade over one gray, resized & equalized copy of the frame.
+// With at least as many models as threads, the models run side by side, one per worker;
+// with fewer they run one after another, each spreading its own scales over the thread pool,
+// so that the cores are busy either way. A classifier only ever runs on one thread at once.
+void cascade::detectAll(CascadeRegistry &registry, Mat &frame, CascadeConfig &config, vector<CascadeHit> &hits) {
+    hits.clear();
+    if (registry.classifiers.empty()) {
+        return;
+    }
+
+    double scale = min(1.0, config.detectScale);
+    Mat &search = searchImage(frame, scale, registry.gray, registry.small);
+
+    // the size limits apply to every model, as for faces
+    int minSize = cvRound(config.minFace * scale);
+    int maxSize = cvRound(config.maxFace * scale);
+    int numModels = (int)registry.classifiers.size();
+    auto detect = [&](int i) {
+        registry.classifiers[i].detectMultiScale(search, registry.found[i], config.scaleFactor, config.minNeighbors, 0,
+                                                 Size(minSize, minSize), config.maxFace > 0 ? Size(maxSize, maxSize) : Size());
+    };
+    if (numModels >= cv::getNumThreads()) {
+        cv::parallel_for_(Range(0, numModels), [&](const Range &range) {
+            for (int i = range.start; i < range.end; i++) {
+                detect(i);
+            }
+        }, numModels);
+    } else {
+        for (int i = 0; i < numModels; i++) {
+            detect(i);
+        }
+    }
+
+    // merge, labeled by model
+    for (int i = 0; i < numModels; i++) {
+        for (const Rect &r : registry.found[i]) {
+            CascadeHit hit;
+            hit.model = i;
+            hit.rect = toFrame(r, scale);
+            hits.push_back(hit);
+        }
+    }
+}
+
+// Draw every hit with the label of its model, a color per model
+void cascade::drawHits(Mat &frame, CascadeRegistry &registry, vector<CascadeHit> &hits) {
+    const Scalar colors[] = {Scalar(255, 153, 51), Scalar(0, 255, 255), Scalar(0, 200, 0), Scalar(255, 0, 255),
+                             Scalar(0, 128, 255), Scalar(255, 255, 0), Scalar(0, 0, 255), Scalar(128, 0, 255)};
+    const int numColors = sizeof(colors) / sizeof(colors[0]);
+
+    for (const CascadeHit &hit : hits) {
+        const Scalar &color = colors[hit.model % numColors];
+        cv::rectangle(frame, hit.rect, color, 2);
+        cv::putText(frame, registry.names[hit.model], Point(hit.rect.x, max(12, hit.rect.y - 6)), FONT_HERSHEY_SIMPLEX, 0.6, color, 2);
+    }
+}
+
+// process the video stream
 // reference OpenCV: https://docs.opencv.org/3.4/db/d28/tutorial_cascade_classifier.html
-void cascade::detectAndDisplay(Mat &frame) {
-    Mat gray;
-    cv::cvtColor(frame, gray, COLOR_BGR2GRAY);
-    cv::equalizeHist(gray, gray);
+int cascade::cascadeVideoStream(CascadeConfig &config, string &videoSource, SourceConfig &sourceConfig, bool headless) {
+    // the face & eye engine, or a registry of the cascades asked for
+    CascadeLibrary library;
+    vector<string> models = cascade::configModels(config);
+    if (cascade::loadLibrary(library, models) != 0) {
+        return -1;
+    }
+    CascadeEngine engine;
+    CascadeRegistry registry;
+    if (config.models.empty()) {
+        if (cascade::loadEngine(engine, config, library) != 0) {
+            return -1;
+        }
+    } else {
+        if (cascade::loadRegistry(registry, config.models, library) != 0) {
+            return -1;
+        }
+        printf("Running %d cascades\n", (int)registry.names.size());
+    }
 
-    // faces
-    vector<Rect> faces;
-    face_cascade.detectMultiScale(gray, faces);
+    cout << "\nStart video mode\n";
+    // process::classifyObjectByVideo(db, standardFeature);
+    // the camera, or a recorded source
+    FrameSource source;
+    if (!framesource::open(source, videoSource, sourceConfig)) {
+        printf("Unable to open video source %s\n", videoSource.c_str());
+        return (-1);
+    }
 
-    // draw
-    for (size_t i = 0; i < faces.size(); i++) {
-        // find the center of face
-        Point center(faces[i].x + faces[i].width / 2, faces[i].y + faces[i].height / 2);
-        // draw an ellipse on top of the face frame
-        cv::ellipse(frame, center, Size(faces[i].width / 2, faces[i].height / 2), 0, 0, 360, Scalar(255, 153, 51), 2);
+    // get some properties of the image
+    cv::Size refS = framesource::frameSize(source);
+    printf("Expected size: %d %d\n", refS.width, refS.height);
+
+    if (!headless) {
+        cv::namedWindow("Video", 1);
+    }
+    cv::Mat frame;
+    vector<FaceDetection> faces;
+    vector<CascadeHit> hits;
+    int64 runStart = cv::getTickCount(), reportStart = runStart;
+    double detectTicks = 0;
+    long long frames = 0, totalHits = 0;
+    unsigned long long digest = 1469598103934665603ULL;
+    for (int n = 1;; n++) {
+        if (!framesource::read(source, frame)) {
+            printf("end of the video source\n");
+            break;
+        }
 
-        Mat faceArea = gray(faces[i]);
+        int64 start = cv::getTickCount();
+        if (config.models.empty()) {
+            cascade::detectFaces(engine, frame, config, faces);
+            for (FaceDetection &f : faces) {
+                hashRect(digest, f.face);
+                for (Rect &eye : f.eyes) {
+                    hashRect(digest, eye);
+                }
+                totalHits += 1 + f.eyes.size();
+            }
+            if (!headless) {
+                cascade::drawFaces(frame, faces);
+            }
+        } else {
+            cascade::detectAll(registry, frame, config, hits);
+            for (CascadeHit &hit : hits) {
+                hashRect(digest, hit.rect);
+            }
+            totalHits += hits.size();
+            if (!headless) {
+                cascade::drawHits(frame, registry, hits);
+            }
+        }
+        detectTicks += cv::getTickCount() - start;
+        frames++;
 
-        // eyes
-        vector<Rect> eyes;
-        eyes_cascade.detectMultiScale(faceArea, eyes);
+        if (n % 100 == 0) {
+            double seconds = (cv::getTickCount() - reportStart) / cv::getTickFrequency();
+            printf("cascade: %.1f fps, %.2f ms per frame to detect & draw\n", 100 / seconds, detectTicks * 1000.0 / cv::getTickFrequency() / 100);
+            reportStart = cv::getTickCount();
+            detectTicks = 0;
+        }
 
-        // draw
-        for (size_t j = 0; j < eyes.size(); j++) {
-            // find the center of eyes
-            Point center_of_eyes(faces[i].x + eyes[j].x + eyes[j].width / 2, faces[i].y + eyes[j].y + eyes[j].height / 2);
-            // radius
-            int r = cvRound((eyes[j].width + eyes[j].height) / 4.0);
-            // draw circle
-            cv::circle(frame, center_of_eyes, r, Scalar(0, 255, 255), 2);
+        if (!headless) {
+            cv::imshow("Video", frame);
+            if (cv::waitKey(1) == 'q') {
+                break;
+            }
         }
     }
 
+    double seconds = (cv::getTickCount() - runStart) / cv::getTickFrequency();
+    printf("summary: %lld frames in %.2f s, fps %.1f | hits %lld | hit digest %016llx\n", frames, seconds, frames / seconds,
+           totalHits, digest);
+
+    return 0;
+}
+
+// apply Haar Cascade detection to the identify face and eyes in the frame
+void cascade::detectAndDisplay(CascadeEngine &engine, Mat &frame, CascadeConfig &config) {
+    vector<FaceDetection> faces;
+    cascade::detectFaces(engine, frame, config, faces);
+    cascade::drawFaces(frame, faces);
+
     cv::namedWindow("Video", 1);  // identifies a window
     cv::imshow("Video", frame);
-}
\ No newline at end of file
+}
@@ -11,74 +11,99 @@
 using namespace cv;
 using namespace std;
 
-// Calculate each feature's standard diviations of the training image data
-Feature classify::calculateFeatureStdDev(vector<ImgData> &traingImgData) {
-    Feature stdDev;
+// Add a value to the running statistics
+// https://en.wikipedia.org/wiki/Algorithms_for_calculating_variance#Welford's_online_algorithm
+void classify::addSample(RunningStat &stat, double value) {
+    stat.count++;
+    double delta = value - stat.mean;
+    stat.mean += delta / stat.count;
+    stat.m2 += delta * (value - stat.mean);
+}
 
-    vector<double> fillRatios;
-    vector<double> bboxDimRatios;
-    vector<double> axisDimRatios;
-    // https://stackoverflow.com/questions/21663256/how-to-initialize-a-vector-of-vectors-on-a-struct
-    // only assign dimension of 6 buckets
-    vector<vector<double>> huMomentsList(6);
+// Merge the statistics of another set of samples, e.g. from another thread
+// https://en.wikipedia.org/wiki/Algorithms_for_calculating_variance#Parallel_algorithm
+void classify::mergeStats(RunningStat &dst, const RunningStat &src) {
+    if (src.count == 0) {
+        return;
+    }
+    if (dst.count == 0) {
+        dst = src;
+        return;
+    }
 
-    for (int i = 0; i < traingImgData.size(); i++) {
-        ImgData curr = traingImgData[i];
-        fillRatios.push_back(curr.features.fillRatio);
-        bboxDimRatios.push_back(curr.features.bboxDimRatio);
-        axisDimRatios.push_back(curr.features.axisDimRatio);
-
-        // NOTE: here is to assign the corresponding huMoment to its associated bucket
-        for (int j = 0; j < curr.features.huMoments.size(); j++) {
-            huMomentsList[j].push_back(curr.features.huMoments[j]);
-        }
+    long long count = dst.count + src.count;
+    double delta = src.mean - dst.mean;
+    dst.mean += delta * src.count / count;
+    dst.m2 += src.m2 + delta * delta * ((double)dst.count * src.count / count);
+    dst.count = count;
+}
+
+double classify::stdDev(const RunningStat &stat) {
+    if (stat.count == 0) {
+        return 0.0;
     }
+    return sqrt(stat.m2 / stat.count);
+}
 
-    stdDev.fillRatio = classify::calculateStdDev(fillRatios);
-    stdDev.bboxDimRatio = classify::calculateStdDev(bboxDimRatios);
-    stdDev.axisDimRatio = classify::calculateStdDev(axisDimRatios);
+void classify::addFeature(FeatureStats &stats, Feature &feature) {
+    classify::addSample(stats.fillRatio, feature.fillRatio);
+    classify::addSample(stats.bboxDimRatio, feature.bboxDimRatio);
+    classify::addSample(stats.axisDimRatio, feature.axisDimRatio);
+    for (int i = 0; i < feature.huMoments.size() && i < NUM_HU_MOMENTS; i++) {
+        classify::addSample(stats.huMoments[i], feature.huMoments[i]);
+    }
+}
 
-    vector<double> stdDevHuMoment;
-    for (int i = 0; i < huMomentsList.size(); i++) {
-        double stdDevAtBucket = classify::calculateStdDev(huMomentsList[i]);
-        stdDevHuMoment.push_back(stdDevAtBucket);
+void classify::mergeFeatureStats(FeatureStats &dst, const FeatureStats &src) {
+    classify::mergeStats(dst.fillRatio, src.fillRatio);
+    classify::mergeStats(dst.bboxDimRatio, src.bboxDimRatio);
+    classify::mergeStats(dst.axisDimRatio, src.axisDimRatio);
+    for (int i = 0; i < NUM_HU_MOMENTS; i++) {
+        classify::mergeStats(dst.huMoments[i], src.huMoments[i]);
     }
-    stdDev.huMoments = stdDevHuMoment;
+}
 
+// Each feature's standard diviation
+Feature classify::featureStdDev(const FeatureStats &stats) {
+    Feature stdDev;
+    stdDev.fillRatio = classify::stdDev(stats.fillRatio);
+    stdDev.bboxDimRatio = classify::stdDev(stats.bboxDimRatio);
+    stdDev.axisDimRatio = classify::stdDev(stats.axisDimRatio);
+    for (int i = 0; i < NUM_HU_MOMENTS; i++) {
+        stdDev.huMoments.push_back(classify::stdDev(stats.huMoments[i]));
+    }
     return stdDev;
 }
 
-// Calculate the standard diviation given a list of numbers
-// https://www.khanacademy.org/math/statistics-probability/summarizing-quantitative-data/variance-standard-deviation-population/a/calculating-standard-deviation-step-by-step
+// Calculate each feature's standard diviations of the training image data
+Feature classify::calculateFeatureStdDev(vector<ImgData> &traingImgData) {
+    FeatureStats stats;
+    for (int i = 0; i < traingImgData.size(); i++) {
+        classify::addFeature(stats, traingImgData[i].features);
+    }
+    return classify::featureStdDev(stats);
+}
+
+// Calculate the standard diviation given a list of numbers, in one pass
 double classify::calculateStdDev(vector<double> &data) {
-    // Step 1 : Find the mean.
-    // Step 2 : For each data point, find the square of its distance to the mean.
-    // Step 3 : Sum the values from Step 2.
-    // Step 4 : Divide by the number of data points.
-    // Step 5: Take the square root.
-    int n = data.size();
-    double sum = std::accumulate(data.begin(), data.end(), 0.0);
-    double mean = sum / n;
-
-    double squareDistSum = 0.0;
+    RunningStat stat;
     for (double d : data) {
-        squareDistSum += (d - mean) * (d - mean);
+        classify::addSample(stat, d);
     }
-
-    return sqrt(squareDistSum / n);
+    return classify::stdDev(stat);
 }
 
 // Compare with image's feature in db and standard diviated feature, to find the closest feature's label
-string classify::classifyObject(Feature &src, map<string, vector<Feature>> &db, Feature &stdDevFeature) {
+string classify::classifyObject(Feature &src, map<string, vector<Feature>> &db, Feature &stdDevFeature, double maxDist) {
     string res = "unknown";
 
-    double minDist = 1000;
+    double minDist = maxDist;
 
     // https://stackoverflow.com/questions/26281979/c-loop-through-map
     // map[first, second] -> [label, list of features]
-    for (auto const &img : db) {
+    for (auto &img : db) {
         double dist = 0.0;
-        for (Feature cmpFeature : img.second) {
+        for (Feature &cmpFeature : img.second) {
             dist += classify::euclideanDist(src, cmpFeature, stdDevFeature);
         }
         dist /= (double)img.second.size();
@@ -121,10 +146,10 @@ bool sortByDistance(pair<string, double> p1, pair<string, double> p2) {
 
 // Classify object by K nearest neighbors
 // https://www.youtube.com/watch?v=HVXime0nQeI
-string classify::classifyObjectByKNN(Feature &src, map<string, vector<Feature>> &db, Feature &stdDevFeature) {
+string classify::classifyObjectByKNN(Feature &src, map<string, vector<Feature>> &db, Feature &stdDevFeature, int k, double maxDist) {
     string res = "unknown";
 
-    double minDist = 1000;
+    double minDist = maxDist;
 
     // 1. get euclidean distance from source to features in db
     // 2. sort the distance
@@ -132,8 +157,8 @@ string classify::classifyObjectByKNN(Feature &src, map<string, vector<Feature>>
     // 4. classify the object by the label if it is < minimal distance requirement
 
     vector<pair<string, double>> distPairs;
-    for (auto const &img : db) {
-        for (Feature cmpFeature : img.second) {
+    for (auto &img : db) {
+        for (Feature &cmpFeature : img.second) {
             double dist = classify::euclideanDist(src, cmpFeature, stdDevFeature);
             distPairs.push_back(make_pair(img.first, dist));
         }
@@ -141,9 +166,8 @@ string classify::classifyObjectByKNN(Feature &src, map<string, vector<Feature>>
 
     sort(distPairs.begin(), distPairs.end(), sortByDistance);
 
-    // 8 nearest neighbors
-    int k = 8;
-    k = distPairs.size() < 8 ? distPairs.size() : k;
+    // k nearest neighbors
+    k = distPairs.size() < k ? distPairs.size() : k;
     map<string, int> labelCnt;
     double sumKDist = 0.0;
 
@@ -171,3 +195,28 @@ string classify::classifyObjectByKNN(Feature &src, map<string, vector<Feature>>
 
     return res;
 }
+
+// Classify by the method chosen in the config
+string classify::classifyFeature(Feature &src, FeatureModel &model, ClassifyConfig &config) {
+    if (config.legacy && model.legacyDb) {
+        if (config.method == "e") {
+            return classify::classifyObject(src, *model.legacyDb, *model.legacyStdDev, config.maxDist);
+        }
+        return classify::classifyObjectByKNN(src, *model.legacyDb, *model.legacyStdDev, config.k, config.maxDist);
+    }
+
+    if (config.method == "e") {
+        return model::classifyNearestMean(model, src, config.maxDist);
+    }
+    return model::classifyKNN(model, src, config.k, config.maxDist, config.weighted);
+}
+
+// Classify the detections of a frame as one batch on the OpenCV thread pool.
+// The model is read-only and its query buffers are per thread, so the workers share nothing.
+void classify::classifyDetections(vector<Detection> &detections, FeatureModel &model, ClassifyConfig &config) {
+    cv::parallel_for_(Range(0, (int)detections.size()), [&](const Range &range) {
+        for (int i = range.start; i < range.end; i++) {
+            detections[i].label = classify::classifyFeature(detections[i].features, model, config);
+        }
+    });
+}
@@ -0,0 +1,239 @@
+#include "featuredb.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include "classify.hpp"
+#include "process.hpp"
+
+using namespace std;
+
+// Binary layout, every field is fixed-width so the file can be read straight from the mapped memory:
+//   Header | label names (numLabels x LABEL_LEN bytes) | records (numRecords x Record)
+// Bump VERSION whenever the layout or the feature calculation changes.
+static const char MAGIC[8] = {'O', 'B', 'J', 'F', 'D', 'B', '\0', '\0'};
+static const uint32_t VERSION = 2;
+static const int LABEL_LEN = 32;
+static const int NUM_HU = 6;
+static const int NUM_VALUES = 3 + NUM_HU;
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t numLabels;
+    uint64_t numRecords;
+    uint64_t sourceHash;
+    // count, mean & sum of squared deviations of every value, so new samples can be merged into them
+    int64_t statCount[NUM_VALUES];
+    double statMean[NUM_VALUES];
+    double statM2[NUM_VALUES];
+};
+
+struct Record {
+    uint32_t labelIdx;
+    uint32_t reserved;
+    double values[NUM_VALUES];
+};
+
+// FNV-1a hash of the training files' names, modification times and sizes, and of the segmentation settings
+static uint64_t hashSources(vector<featuredb::SourceFile> &sources, const SegmentConfig &config) {
+    uint64_t hash = 14695981039346656037ULL;
+    double settings[] = {(double)config.threshold, (double)config.closeIterations, (double)config.adaptiveBlock, config.adaptiveC};
+    for (size_t j = 0; j < sizeof(settings); j++) {
+        hash ^= ((const unsigned char *)settings)[j];
+        hash *= 1099511628211ULL;
+    }
+    for (size_t j = 0; j <= config.thresholdMethod.size(); j++) {
+        hash ^= (unsigned char)config.thresholdMethod.c_str()[j];
+        hash *= 1099511628211ULL;
+    }
+    for (int i = 0; i < sources.size(); i++) {
+        const char *name = sources[i].name.c_str();
+        long long stamps[2] = {sources[i].mtime, sources[i].size};
+        const unsigned char *bytes[2] = {(const unsigned char *)name, (const unsigned char *)stamps};
+        size_t lengths[2] = {strlen(name) + 1, sizeof(stamps)};
+
+        for (int b = 0; b < 2; b++) {
+            for (size_t j = 0; j < lengths[b]; j++) {
+                hash ^= bytes[b][j];
+                hash *= 1099511628211ULL;
+            }
+        }
+    }
+    return hash;
+}
+
+static void packFeature(const Feature &src, double *dst) {
+    dst[0] = src.fillRatio;
+    dst[1] = src.bboxDimRatio;
+    dst[2] = src.axisDimRatio;
+    for (int i = 0; i < NUM_HU; i++) {
+        dst[3 + i] = src.huMoments[i];
+    }
+}
+
+static Feature unpackFeature(const double *src) {
+    Feature dst;
+    dst.fillRatio = src[0];
+    dst.bboxDimRatio = src[1];
+    dst.axisDimRatio = src[2];
+    dst.huMoments.assign(src + 3, src + NUM_VALUES);
+    return dst;
+}
+
+// the running statistics of every value, in the record order
+static void statList(FeatureStats &stats, RunningStat **dst) {
+    dst[0] = &stats.fillRatio;
+    dst[1] = &stats.bboxDimRatio;
+    dst[2] = &stats.axisDimRatio;
+    for (int i = 0; i < NUM_HU; i++) {
+        dst[3 + i] = &stats.huMoments[i];
+    }
+}
+
+// List the training images with the information needed to detect changes
+vector<featuredb::SourceFile> featuredb::scanSourceFiles(const char *dirname) {
+    vector<SourceFile> sources;
+    vector<string> names = process::listImageFiles(dirname);
+
+    for (int i = 0; i < names.size(); i++) {
+        string path = string(dirname) + "/" + names[i];
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) {
+            continue;
+        }
+
+        SourceFile file;
+        file.name = names[i];
+        file.mtime = (long long)st.st_mtime;
+        file.size = (long long)st.st_size;
+        sources.push_back(file);
+    }
+
+    return sources;
+}
+
+// Map the database file and rebuild the feature map from it
+bool featuredb::load(const char *path, vector<SourceFile> &sources, const SegmentConfig &config, map<string, vector<Feature>> &db, FeatureStats &stats) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Header)) {
+        close(fd);
+        return false;
+    }
+
+    size_t fileSize = (size_t)st.st_size;
+    void *addr = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+
+    const char *base = (const char *)addr;
+    const Header *header = (const Header *)base;
+
+    // validate before touching any record
+    bool valid = memcmp(header->magic, MAGIC, sizeof(MAGIC)) == 0 &&
+                 header->version == VERSION &&
+                 header->sourceHash == hashSources(sources, config) &&
+                 header->numRecords <= fileSize / sizeof(Record) &&
+                 fileSize == sizeof(Header) + (size_t)header->numLabels * LABEL_LEN + header->numRecords * sizeof(Record);
+
+    if (valid) {
+        const char *labels = base + sizeof(Header);
+        const Record *records = (const Record *)(labels + (size_t)header->numLabels * LABEL_LEN);
+
+        db.clear();
+        for (uint64_t i = 0; i < header->numRecords && valid; i++) {
+            if (records[i].labelIdx >= header->numLabels) {
+                valid = false;
+                break;
+            }
+            const char *label = labels + (size_t)records[i].labelIdx * LABEL_LEN;
+            db[string(label, strnlen(label, LABEL_LEN))].push_back(unpackFeature(records[i].values));
+        }
+        RunningStat *dst[NUM_VALUES];
+        statList(stats, dst);
+        for (int i = 0; i < NUM_VALUES; i++) {
+            dst[i]->count = header->statCount[i];
+            dst[i]->mean = header->statMean[i];
+            dst[i]->m2 = header->statM2[i];
+        }
+    }
+
+    munmap(addr, fileSize);
+
+    if (!valid) {
+        db.clear();
+    }
+    return valid;
+}
+
+// Write the database into a temporary file first, and then move it into place
+int featuredb::save(const char *path, vector<SourceFile> &sources, const SegmentConfig &config, map<string, vector<Feature>> &db, FeatureStats &stats) {
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.numLabels = db.size();
+    header.sourceHash = hashSources(sources, config);
+    RunningStat *src[NUM_VALUES];
+    statList(stats, src);
+    for (int i = 0; i < NUM_VALUES; i++) {
+        header.statCount[i] = src[i]->count;
+        header.statMean[i] = src[i]->mean;
+        header.statM2[i] = src[i]->m2;
+    }
+
+    vector<char> labels(db.size() * LABEL_LEN, '\0');
+    vector<Record> records;
+    uint32_t labelIdx = 0;
+    for (auto const &entry : db) {
+        if (entry.first.size() >= LABEL_LEN) {
+            printf("Label %s is too long for the feature database\n", entry.first.c_str());
+            return (-1);
+        }
+        memcpy(&labels[labelIdx * LABEL_LEN], entry.first.c_str(), entry.first.size());
+
+        for (const Feature &feature : entry.second) {
+            Record record;
+            record.labelIdx = labelIdx;
+            record.reserved = 0;
+            packFeature(feature, record.values);
+            records.push_back(record);
+        }
+        labelIdx++;
+    }
+    header.numRecords = records.size();
+
+    string tmpPath = string(path) + ".tmp";
+    FILE *fp = fopen(tmpPath.c_str(), "wb");
+    if (!fp) {
+        printf("Unable to open output file %s\n", tmpPath.c_str());
+        return (-1);
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    ok = ok && fwrite(labels.data(), 1, labels.size(), fp) == labels.size();
+    ok = ok && fwrite(records.data(), sizeof(Record), records.size(), fp) == records.size();
+    ok = (fclose(fp) == 0) && ok;
+
+    if (!ok || rename(tmpPath.c_str(), path) != 0) {
+        printf("Unable to write feature database %s\n", path);
+        remove(tmpPath.c_str());
+        return (-1);
+    }
+
+    return (0);
+}
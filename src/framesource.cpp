@@ -0,0 +1,115 @@
+#include "framesource.hpp"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <opencv2/opencv.hpp>
+#include <thread>
+
+#include "process.hpp"
+
+using namespace cv;
+using namespace std;
+
+// Open a camera, a directory of images, or a video file / image sequence
+bool framesource::open(FrameSource &source, const string &spec, const SourceConfig &config) {
+    source.capture.release();
+    source.files.clear();
+    source.frameSize = Size();
+    source.next = 0;
+    source.loop = 0;
+    source.delivered = 0;
+    source.live = false;
+    source.spec = spec;
+    source.config = config;
+
+    bool isDevice = !spec.empty() && all_of(spec.begin(), spec.end(), [](char c) { return isdigit((unsigned char)c) != 0; });
+    struct stat st;
+    if (isDevice) {
+        source.live = true;
+        return source.capture.open(atoi(spec.c_str()));
+    } else if (stat(spec.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+        source.files = process::listImageFiles(spec.c_str());
+        // the size of the first image that decodes is the size of every frame, known before the first read
+        for (const string &name : source.files) {
+            Mat first = cv::imread(spec + "/" + name);
+            if (!first.empty()) {
+                source.frameSize = first.size();
+                break;
+            }
+        }
+        if (source.frameSize.area() == 0) {
+            printf("No readable images in %s\n", spec.c_str());
+            return false;
+        }
+        return true;
+    }
+    return source.capture.open(spec);
+}
+
+// read the next frame of the current loop, without pacing
+static bool readNext(FrameSource &source, Mat &frame) {
+    if (!source.files.empty()) {
+        // skip the images that cannot be decoded, so every run sees the same frames
+        while (source.next < source.files.size()) {
+            frame = cv::imread(source.spec + "/" + source.files[source.next++]);
+            if (frame.empty()) {
+                continue;
+            }
+            if (frame.size() != source.frameSize) {
+                cv::resize(frame, frame, source.frameSize, 0, 0, INTER_AREA);
+            }
+            return true;
+        }
+        return false;
+    }
+
+    source.capture >> frame;
+    return !frame.empty();
+}
+
+// rewind a file or directory for the next loop
+static bool rewind(FrameSource &source) {
+    if (source.live || ++source.loop >= source.config.loops) {
+        return false;
+    }
+    if (!source.files.empty()) {
+        source.next = 0;
+        return true;
+    }
+    return source.capture.set(cv::CAP_PROP_POS_FRAMES, 0);
+}
+
+// Read the next frame, waiting until its time if the source is paced
+bool framesource::read(FrameSource &source, Mat &frame) {
+    if (source.config.maxFrames > 0 && source.delivered >= source.config.maxFrames) {
+        return false;
+    }
+    if (!readNext(source, frame) && !(rewind(source) && readNext(source, frame))) {
+        return false;
+    }
+
+    if (source.delivered == 0) {
+        source.startTick = cv::getTickCount();
+    } else if (source.config.fps > 0 && !source.live) {
+        // a camera delivers at its own rate; a recorded frame n is due n / fps after the first one; a late frame is delivered at once, without catching up by dropping
+        double due = source.delivered / source.config.fps;
+        double now = (cv::getTickCount() - source.startTick) / cv::getTickFrequency();
+        if (due > now) {
+            this_thread::sleep_for(chrono::microseconds((long long)((due - now) * 1e6)));
+        }
+    }
+    source.delivered++;
+    return true;
+}
+
+Size framesource::frameSize(FrameSource &source) {
+    if (!source.files.empty()) {
+        return source.frameSize;
+    }
+    return Size((int)source.capture.get(cv::CAP_PROP_FRAME_WIDTH), (int)source.capture.get(cv::CAP_PROP_FRAME_HEIGHT));
+}
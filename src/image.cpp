@@ -1,9 +1,18 @@
 #include "image.hpp"
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <mutex>
 #include <opencv2/opencv.hpp>
 #include <vector>
 
+#include "alloccount.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 using namespace cv;
 using namespace std;
 
@@ -18,8 +27,8 @@ int processBoundary(int total, int x) {
     return x;
 }
 
-// Apply a 5x5 Gaussian filter
-int image::blur5x5(cv::Mat &src, cv::Mat &dst) {
+// Apply a 5x5 Gaussian filter, the original per-pixel version, kept as the reference of blur5x5
+int image::blur5x5Reference(cv::Mat &src, cv::Mat &dst) {
     Mat temp;
     float r, c;
 
@@ -83,6 +92,109 @@ int image::blur5x5(cv::Mat &src, cv::Mat &dst) {
     return 0;
 }
 
+// s / 10 for every s <= 2550, the largest sum of 5 taps {1, 2, 4, 2, 1} over 8-bit values
+static inline int div10(int s) {
+    return (s * 6554) >> 16;
+}
+
+// Vertical 1 2 4 2 1 pass over n bytes of 5 source rows, into one row of 16-bit sums divided by 10
+static void blurColumn(const uchar *r0, const uchar *r1, const uchar *r2, const uchar *r3, const uchar *r4, uchar *out, int n) {
+    int j = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i magic = _mm_set1_epi16(6554);
+    for (; j + 8 <= n; j += 8) {
+        __m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(r0 + j)), zero);
+        __m128i b = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(r1 + j)), zero);
+        __m128i c = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(r2 + j)), zero);
+        __m128i d = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(r3 + j)), zero);
+        __m128i e = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(r4 + j)), zero);
+        __m128i sum = _mm_add_epi16(_mm_add_epi16(a, e), _mm_slli_epi16(_mm_add_epi16(_mm_add_epi16(b, d), _mm_slli_epi16(c, 1)), 1));
+        __m128i q = _mm_mulhi_epu16(sum, magic);
+        _mm_storel_epi64((__m128i *)(out + j), _mm_packus_epi16(q, zero));
+    }
+#endif
+    for (; j < n; j++) {
+        out[j] = div10(r0[j] + 2 * r1[j] + 4 * r2[j] + 2 * r3[j] + r4[j]);
+    }
+}
+
+// Horizontal 1 2 4 2 1 pass over a row of cols pixels of cn interleaved channels.
+// The 2 border pixels on each side read through the reflected column table, the interior reads its neighbors directly.
+static void blurRow(const uchar *row, uchar *out, int cols, int cn, const int *colIdx) {
+    int border = min(2, cols);
+    for (int x = 0; x < cols; x++) {
+        if (x == border && cols - 2 > border) {
+            x = cols - 2;
+        }
+        for (int ch = 0; ch < cn; ch++) {
+            int s = row[colIdx[x] * cn + ch] + 2 * row[colIdx[x + 1] * cn + ch] + 4 * row[colIdx[x + 2] * cn + ch] + 2 * row[colIdx[x + 3] * cn + ch] + row[colIdx[x + 4] * cn + ch];
+            out[x * cn + ch] = div10(s);
+        }
+    }
+
+    // interior, the taps of a channel are cn bytes apart
+    int begin = 2 * cn, end = (cols - 2) * cn;
+    int j = begin;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i magic = _mm_set1_epi16(6554);
+    for (; j + 8 <= end; j += 8) {
+        __m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row + j - 2 * cn)), zero);
+        __m128i b = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row + j - cn)), zero);
+        __m128i c = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row + j)), zero);
+        __m128i d = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row + j + cn)), zero);
+        __m128i e = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row + j + 2 * cn)), zero);
+        __m128i sum = _mm_add_epi16(_mm_add_epi16(a, e), _mm_slli_epi16(_mm_add_epi16(_mm_add_epi16(b, d), _mm_slli_epi16(c, 1)), 1));
+        __m128i q = _mm_mulhi_epu16(sum, magic);
+        _mm_storel_epi64((__m128i *)(out + j), _mm_packus_epi16(q, zero));
+    }
+#endif
+    for (; j < end; j++) {
+        out[j] = div10(row[j - 2 * cn] + 2 * row[j - cn] + 4 * row[j] + 2 * row[j + cn] + row[j + 2 * cn]);
+    }
+}
+
+// reflected index of offset x, like processBoundary, kept inside [0, total) for images under 2 pixels
+static int reflectIndex(int total, int x) {
+    return min(max(processBoundary(total, x), 0), total - 1);
+}
+
+// Apply a 5x5 Gaussian filter, 1 2 4 2 1 / 10 vertically then horizontally, bit-exact with blur5x5Reference.
+// Integer sums divided by a multiply & shift replace the float math, reflected row & column indexes are
+// computed once instead of per tap, and both passes run on row pointers 8 bytes at a time with SSE2.
+// Each output row is produced from its own vertical pass in a per-thread buffer, so there is no full
+// intermediate image, and the rows are split across the OpenCV thread pool.
+int image::blur5x5(cv::Mat &src, cv::Mat &dst) {
+    if (src.depth() != CV_8U || src.empty()) {
+        return (-1);
+    }
+    // the rows are read after dst rows are written, so a blur in place reads a copy
+    Mat input = src.data == dst.data ? src.clone() : src;
+    dst.create(input.size(), input.type());
+
+    int rows = input.rows, cols = input.cols, cn = input.channels();
+    vector<int> rowIdx(rows + 4), colIdx(cols + 4);
+    for (int y = -2; y < rows + 2; y++) {
+        rowIdx[y + 2] = reflectIndex(rows, y);
+    }
+    for (int x = -2; x < cols + 2; x++) {
+        colIdx[x + 2] = reflectIndex(cols, x);
+    }
+
+    cv::parallel_for_(Range(0, rows), [&](const Range &range) {
+        vector<uchar> column((size_t)cols * cn);
+        for (int y = range.start; y < range.end; y++) {
+            const int *r = &rowIdx[y];
+            blurColumn(input.ptr<uchar>(r[0]), input.ptr<uchar>(r[1]), input.ptr<uchar>(r[2]), input.ptr<uchar>(r[3]), input.ptr<uchar>(r[4]),
+                       column.data(), cols * cn);
+            blurRow(column.data(), dst.ptr<uchar>(y), cols, cn, colIdx.data());
+        }
+    });
+
+    return 0;
+}
+
 // Generate the thresholded version for an image
 Mat thresholdImageCustom(Mat &src) {
     Mat gray(src.rows, src.cols, CV_8UC1);
@@ -178,7 +290,7 @@ Mat thresholdImage2(Mat image) {
 // Generate the thresholded version of an image
 // Here, I first tried customized threshold method. They can render the thresholded image for dark color objects.
 // I find using the opencv method works better when detecting objects with light colors.
-Mat image::thresholdImage(Mat &image) {
+Mat image::thresholdImage(Mat &image, int threshold) {
     // implemented customized threshold method
     // Mat thresholdedImg = thresholdImageCustom(image);
     // Mat thresholdedImg = thresholdImageCustom2(image);
@@ -190,13 +302,129 @@ Mat image::thresholdImage(Mat &image) {
     Mat thresholdedImg(image.rows, image.cols, CV_8UC1);
     // threshold binary invert
     // https://docs.opencv.org/3.4/db/d8e/tutorial_threshold.html
-    cv::threshold(gray, thresholdedImg, 100, 255, THRESH_BINARY_INV);
+    cv::threshold(gray, thresholdedImg, threshold, 255, THRESH_BINARY_INV);
     // Mat cleanUpImg = cleanUpBinary(thresholdedImg);
 
     // return cleanUpImg;
     return thresholdedImg;
 }
 
+// Add the pixels of a gray image to a 256-bin histogram
+void image::addHistogram(const Mat &gray, int hist[256]) {
+    for (int r = 0; r < gray.rows; r++) {
+        const uchar *row = gray.ptr<uchar>(r);
+        for (int c = 0; c < gray.cols; c++) {
+            hist[row[c]]++;
+        }
+    }
+}
+
+// Otsu's threshold: the gray level that maximizes the between-class variance, levels <= threshold being one class
+int image::otsuThreshold(const int hist[256]) {
+    double total = 0.0, sum = 0.0;
+    for (int i = 0; i < 256; i++) {
+        total += hist[i];
+        sum += (double)i * hist[i];
+    }
+
+    double weightB = 0.0, sumB = 0.0, maxVar = -1.0;
+    int best = 0;
+    for (int t = 0; t < 256; t++) {
+        weightB += hist[t];
+        if (weightB == 0) {
+            continue;
+        }
+        double weightF = total - weightB;
+        if (weightF == 0) {
+            break;
+        }
+        sumB += (double)t * hist[t];
+        double meanB = sumB / weightB;
+        double meanF = (sum - sumB) / weightF;
+        double var = weightB * weightF * (meanB - meanF) * (meanB - meanF);
+        if (var > maxVar) {
+            maxVar = var;
+            best = t;
+        }
+    }
+
+    return best;
+}
+
+// ISODATA threshold, the rule of thresholdImageCustom3: start from the mean, and move the threshold to the
+// middle of the two class means until it moves by less than 1. Iterates over the 256 bins instead of the pixels.
+int image::isodataThreshold(const int hist[256]) {
+    // running counts & sums, so a class mean is two subtractions
+    double count[257] = {0.0}, sum[257] = {0.0};
+    for (int i = 0; i < 256; i++) {
+        count[i + 1] = count[i] + hist[i];
+        sum[i + 1] = sum[i] + (double)i * hist[i];
+    }
+    if (count[256] == 0) {
+        return 0;
+    }
+
+    double thresMean = sum[256] / count[256];
+    for (int iter = 0; iter < 256; iter++) {
+        int t = (int)thresMean;  // levels <= t are the front
+        double frontCnt = count[t + 1], backCnt = count[256] - count[t + 1];
+        if (frontCnt == 0 || backCnt == 0) {
+            break;
+        }
+        double frontMean = sum[t + 1] / frontCnt;
+        double backMean = (sum[256] - sum[t + 1]) / backCnt;
+        double newThresMean = (frontMean + backMean) / 2.0;
+
+        // like thresholdImageCustom3, the image is split by the mean from before the last update
+        if (fabs(newThresMean - thresMean) < 1) {
+            break;
+        }
+        thresMean = newThresMean;
+    }
+
+    return (int)thresMean;
+}
+
+// Threshold an image with the method of the config: "fixed" uses config.threshold, "otsu" & "isodata" pick the
+// threshold from the histogram of the blurred gray image, "adaptive" compares every pixel to the mean of its
+// neighborhood; then close it if config.closeIterations is set. The gray level used is returned in chosen,
+// -1 for the adaptive method. gray & dst are only reallocated when the image size changes.
+static void thresholdInto(Mat &image, const SegmentConfig &config, Mat &gray, Mat &dst, int &chosen) {
+    alloccount::ensureMat(gray, image.rows, image.cols, CV_8UC1);
+    alloccount::ensureMat(dst, image.rows, image.cols, CV_8UC1);
+    cvtColor(image, gray, COLOR_BGR2GRAY);
+    cv::GaussianBlur(gray, gray, cv::Size(5, 5), 0);
+
+    if (config.thresholdMethod == "adaptive") {
+        // objects are darker than their surroundings by more than adaptiveC
+        chosen = -1;
+        cv::adaptiveThreshold(gray, dst, 255, ADAPTIVE_THRESH_MEAN_C, THRESH_BINARY_INV, config.adaptiveBlock, config.adaptiveC);
+    } else {
+        chosen = config.threshold;
+        if (config.thresholdMethod == "otsu" || config.thresholdMethod == "isodata") {
+            int hist[256] = {0};
+            image::addHistogram(gray, hist);
+            chosen = config.thresholdMethod == "otsu" ? image::otsuThreshold(hist) : image::isodataThreshold(hist);
+        }
+        cv::threshold(gray, dst, chosen, 255, THRESH_BINARY_INV);
+    }
+
+    if (config.closeIterations > 0) {
+        // the closing of cleanUpBinary, in place
+        static const Mat closingElement = getStructuringElement(MORPH_RECT, Size(4, 4), Point(0, 0));
+        cv::morphologyEx(dst, dst, MORPH_CLOSE, closingElement, Point(-1, -1), config.closeIterations);
+    }
+}
+
+// Threshold an image with the method of the config, without the closing
+Mat image::thresholdImageAuto(Mat &image, const SegmentConfig &config, int &chosen) {
+    SegmentConfig thresholdOnly = config;
+    thresholdOnly.closeIterations = 0;
+    Mat gray, dst;
+    thresholdInto(image, thresholdOnly, gray, dst, chosen);
+    return dst;
+}
+
 // Generate the thresholded version for a list of images
 vector<pair<Mat, Mat>> image::thresholdImages(vector<Mat> &images) {
     vector<pair<Mat, Mat>> thresholdedImgs;
@@ -210,17 +438,115 @@ vector<pair<Mat, Mat>> image::thresholdImages(vector<Mat> &images) {
 
 // Clean up the Binary image by closing. Closing is reverse of Opening, Dilation followed by Erosion.
 // It is useful in closing small holes inside the foreground objects, or small black points on the object.
-cv::Mat image::cleanUpBinary(cv::Mat &src) {
+cv::Mat image::cleanUpBinary(cv::Mat &src, int iterations) {
     cv::Mat dst(src.rows, src.cols, CV_8UC1);
     dst = src.clone();
 
     Mat closingElement = getStructuringElement(MORPH_RECT, Size(4, 4), Point(0, 0));
 
-    // 5 iterations
-    cv::morphologyEx(src, dst, MORPH_CLOSE, closingElement, Point(-1, -1), 5);
+    // 5 iterations by default
+    cv::morphologyEx(src, dst, MORPH_CLOSE, closingElement, Point(-1, -1), iterations);
     return dst;
 }
 
+// bytes of intermediate images a strip may use, about a per-core L2 cache
+const size_t STRIP_BYTES = 256 * 1024;
+
+// Gray conversion, blur, threshold and closing of thresholdImage & cleanUpBinary, run strip by strip.
+// Each strip is read with a halo of the rows its output depends on: 2 for the 5x5 blur, and 2 per dilation
+// or erosion of the 4x4 closing element. The strip's gray, blurred and binary images are per-thread buffers
+// of a few hundred KB that stay in cache, so only the frame and the result go through main memory.
+// The halo rows make the strips' interiors identical to the whole-image result, the strips run in parallel.
+// The histogram methods need the whole frame's histogram before any pixel is thresholded: the strips then
+// keep their blurred gray rows in one image and add up their histograms, and a second pass thresholds & closes.
+Mat image::thresholdImageFused(Mat &image, int threshold, int closeIterations, const string &method, int *chosen) {
+    Mat dst;
+    image::thresholdImageFused(image, dst, threshold, closeIterations, method, chosen);
+    return dst;
+}
+
+// The same into dst, which keeps its buffer from frame to frame, as does the blurred image of the histogram methods
+void image::thresholdImageFused(Mat &image, Mat &dst, int threshold, int closeIterations, const string &method, int *chosen) {
+    int rows = image.rows;
+    bool histogramMethod = method == "otsu" || method == "isodata";
+    int halo = 2 + 4 * max(closeIterations, 0);
+
+    // intermediate bytes of a row: color, gray, blurred, binary & closed.
+    // A strip is at least 8 halos high, or the halo rows processed twice cost more than the cache saves.
+    size_t rowBytes = (size_t)image.cols * (image.channels() + 4);
+    int stripRows = max((int)(STRIP_BYTES / max(rowBytes, (size_t)1)), 8 * halo);
+    int numStrips = (rows + stripRows - 1) / stripRows;
+
+    alloccount::ensureMat(dst, image.rows, image.cols, CV_8UC1);
+    static const Mat closingElement = getStructuringElement(MORPH_RECT, Size(4, 4), Point(0, 0));
+
+    // first pass of the histogram methods: blurred gray rows & histogram.
+    // The buffer is the calling thread's, bound here: inside the strips a thread_local would be each pool worker's own
+    static thread_local Mat blurredBuffer;
+    Mat &blurred = blurredBuffer;
+    if (histogramMethod) {
+        alloccount::ensureMat(blurred, image.rows, image.cols, CV_8UC1);
+        int hist[256] = {0};
+        mutex histMutex;
+        cv::parallel_for_(Range(0, numStrips), [&](const Range &range) {
+            static thread_local Mat gray;
+            int stripHist[256] = {0};
+            for (int s = range.start; s < range.end; s++) {
+                int y0 = s * stripRows, y1 = min(rows, y0 + stripRows);
+                int top = max(0, y0 - 2), bottom = min(rows, y1 + 2);
+
+                Mat strip = image.rowRange(top, bottom);
+                cvtColor(strip, gray, COLOR_BGR2GRAY);
+                cv::GaussianBlur(gray, gray, cv::Size(5, 5), 0);
+
+                Mat interior = gray.rowRange(y0 - top, y1 - top);
+                interior.copyTo(blurred.rowRange(y0, y1));
+                image::addHistogram(interior, stripHist);
+            }
+            lock_guard<mutex> lock(histMutex);
+            for (int i = 0; i < 256; i++) {
+                hist[i] += stripHist[i];
+            }
+        });
+        threshold = method == "otsu" ? image::otsuThreshold(hist) : image::isodataThreshold(hist);
+    }
+    if (chosen) {
+        *chosen = threshold;
+    }
+
+    cv::parallel_for_(Range(0, numStrips), [&](const Range &range) {
+        static thread_local Mat gray, binary, closed;
+        for (int s = range.start; s < range.end; s++) {
+            int y0 = s * stripRows, y1 = min(rows, y0 + stripRows);
+            int top = max(0, y0 - halo), bottom = min(rows, y1 + halo);
+
+            // the blurred rows of the strip, from the first pass or computed here
+            Mat blurredStrip;
+            if (histogramMethod) {
+                blurredStrip = blurred.rowRange(top, bottom);
+            } else {
+                Mat strip = image.rowRange(top, bottom);
+                cvtColor(strip, gray, COLOR_BGR2GRAY);
+                cv::GaussianBlur(gray, gray, cv::Size(5, 5), 0);
+                blurredStrip = gray;
+            }
+
+            if (closeIterations <= 0) {
+                // no closing, the interior rows are thresholded straight into the result
+                Mat interior = blurredStrip.rowRange(y0 - top, y1 - top);
+                Mat out = dst.rowRange(y0, y1);
+                cv::threshold(interior, out, threshold, 255, THRESH_BINARY_INV);
+                continue;
+            }
+
+            cv::threshold(blurredStrip, binary, threshold, 255, THRESH_BINARY_INV);
+            cv::morphologyEx(binary, closed, MORPH_CLOSE, closingElement, Point(-1, -1), closeIterations);
+            closed.rowRange(y0 - top, y1 - top).copyTo(dst.rowRange(y0, y1));
+        }
+    });
+
+}
+
 // Run connected compoenents analysis for an image, using OpenCV method
 pair<Mat, int> image::connectedComponents(Mat &image) {
     // run connected compoenents analysis
@@ -229,6 +555,11 @@ pair<Mat, int> image::connectedComponents(Mat &image) {
     // 8 way connectivity
     int nLabels = cv::connectedComponents(src, labelImage, 8);
 
+    return make_pair(image::colorRegions(labelImage, nLabels), nLabels);
+}
+
+// Paint every region of a label image with a random color, for display only
+Mat image::colorRegions(Mat &labelImage, int nLabels) {
     std::vector<Vec3b> colors(nLabels);
     // 0 represents the background label
     colors[0] = Vec3b(0, 0, 0);
@@ -236,16 +567,16 @@ pair<Mat, int> image::connectedComponents(Mat &image) {
         colors[label] = Vec3b((rand() & 255), (rand() & 255), (rand() & 255));
     }
 
-    Mat dst(src.size(), CV_8UC3);
+    Mat dst(labelImage.size(), CV_8UC3);
     for (int r = 0; r < dst.rows; ++r) {
+        const int *labelRow = labelImage.ptr<int>(r);
+        Vec3b *dstRow = dst.ptr<Vec3b>(r);
         for (int c = 0; c < dst.cols; ++c) {
-            int label = labelImage.at<int>(r, c);
-            Vec3b &pixel = dst.at<Vec3b>(r, c);
-            pixel = colors[label];
+            dstRow[c] = colors[labelRow[c]];
         }
     }
 
-    return make_pair(dst, nLabels);
+    return dst;
 }
 
 // Run connected compoenents analysis on the thresholded and cleaned image to get regions.
@@ -260,44 +591,216 @@ vector<pair<Mat, Mat>> image::connectedComponentsImages(vector<Mat> &images) {
     return res;
 }
 
+static void featuresInto(vector<Point> &contour, RotatedRect &bbox, Feature &features, vector<Point> &axisEndPoints);
+
+// per-thread intermediate images of the analysis, sized by the first frame and reused by the next ones
+struct Workspace {
+    Mat small;  // pyramid level
+    Mat gray;
+    Mat thresholded;
+    Mat labels;
+    Mat stats;
+    Mat centroids;
+    vector<vector<Point>> contours;
+};
+
+static Workspace &workspace() {
+    static thread_local Workspace ws;
+    return ws;
+}
+
+// Threshold, and close if asked to, with the fused strips or the separate whole-image passes.
+// The adaptive method compares pixels to their neighborhood, it always runs on the whole image.
+static void binaryImage(Mat &view, const SegmentConfig &config, Mat &dst, int &chosen) {
+    if (config.fused && config.thresholdMethod != "adaptive") {
+        image::thresholdImageFused(view, dst, config.threshold, config.closeIterations, config.thresholdMethod, &chosen);
+        return;
+    }
+    thresholdInto(view, config, workspace().gray, dst, chosen);
+}
+
 // Calculate a group of image data of an image
-ImgData image::calculateImgData(Mat &src) {
+// The image is thresholded once, and the thresholded image feeds both the connected components and the contours.
+// The colored regions image is only for display, so it is built only when asked for.
+ImgData image::calculateImgData(Mat &src, const SegmentConfig &config, StageTimer *timer, const Rect &roi) {
     ImgData res;
+    image::analyzeImage(src, res, config, timer, roi);
+    return res;
+}
+
+// Analyze an image into res, reusing its buffers: thresholded image, stats, contours, features & detections
+// keep their memory from the last image res held, and the other intermediates come from a per-thread workspace,
+// so a stream of frames of one size does not allocate Mats once the first frames have sized everything,
+// except for the refined region of --refine and the debug images.
+void image::analyzeImage(Mat &src, ImgData &res, const SegmentConfig &config, StageTimer *timer, const Rect &roi) {
+    Workspace &ws = workspace();
+    res.contour.clear();
+    res.axisEndPoints.clear();
+    res.label.clear();
+    if (!config.multiObject) {
+        res.detections.clear();
+    }
+    res.debug.reset();
 
-    res.original = src;
-    res.thresholded = image::thresholdImage(src);
+    if (timer) timer->begin();
 
-    pair<Mat, int> cc = image::connectedComponents(src);
-    res.regions = cc.first;  // color, type as CV_32S
-    res.numRegions = cc.second;
+    // segment the roi only, a view of src without any copy
+    bool inRoi = roi.area() > 0;
+    Mat view = inRoi ? src(roi) : src;
+
+    // pyramid mode: segment a downscaled copy, area interpolation keeps thin shapes visible to the threshold
+    int factor = 1 << config.pyramidLevels;
+    if (factor > 1) {
+        cv::resize(view, ws.small, Size(), 1.0 / factor, 1.0 / factor, INTER_AREA);
+        view = ws.small;
+        if (timer) timer->lap("downscale");
+    }
+
+    binaryImage(view, config, ws.thresholded, res.threshold);
+    if (timer) timer->lap("threshold");
+
+    alloccount::ensureMat(ws.labels, ws.thresholded.rows, ws.thresholded.cols, CV_32S);
+    int numRegions = cv::connectedComponentsWithStats(ws.thresholded, ws.labels, ws.stats, ws.centroids, 8);
+    if (timer) timer->lap("components");
 
     // contours - https://docs.opencv.org/3.4/d4/d73/tutorial_py_contours_begin.html
-    Mat thres = res.thresholded > 0;
-    // findCountours only support type as CV_8U1
+    // the thresholded image is already binary CV_8UC1, which is what findContours supports
     // RetrievalModes - retrieves only the extreme outer contours
-    cv::findContours(thres, res.contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE);
+    // the offset moves roi contours back to src coordinates
+    vector<vector<Point>> &contours = ws.contours;
+    cv::findContours(ws.thresholded, contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE, factor == 1 && inRoi ? roi.tl() : Point());
+    if (timer) timer->lap("contours");
+
+    if (factor > 1 && !contours.empty()) {
+        image::upscaleContours(contours, factor, inRoi ? roi.tl() : Point());
+        if (config.pyramidRefine) {
+            image::refineContours(src, contours, factor, config);
+            if (timer) timer->lap("refine");
+        }
+    }
+
+    // the intermediate images, copied out of the workspace for display
+    if (config.withDebug) {
+        res.debug.reset(new ImgDebug());
+        res.debug->original = src;
+        res.debug->thresholded = ws.thresholded.clone();
+        res.debug->numRegions = numRegions;
+        res.debug->regionStats = ws.stats.clone();
+        res.debug->contours = contours;
+        if (config.withRegions) {
+            res.debug->regions = image::colorRegions(ws.labels, numRegions);
+        }
+        if (timer) timer->lap("debug");
+    }
+
+    if (contours.empty()) {
+        res.detections.clear();
+        return;
+    }
 
     // find the largest contour
     int maxIdx = 0;
-    for (int i = 0; i < res.contours.size(); i++) {
-        if (res.contours[i].size() >= res.contours[maxIdx].size())
+    for (int i = 0; i < contours.size(); i++) {
+        if (contours[i].size() >= contours[maxIdx].size())
             maxIdx = i;
     }
+    res.contour.assign(contours[maxIdx].begin(), contours[maxIdx].end());
     // get largest shape's bounding box
-    res.bbox = cv::minAreaRect(res.contours[maxIdx]);
+    res.bbox = cv::minAreaRect(res.contour);
 
     // calculate features
-    res.features = image::calculateFeatures(res.regions, res.contours, maxIdx, res.bbox, res.axisEndPoints);
+    featuresInto(res.contour, res.bbox, res.features, res.axisEndPoints);
+    if (config.multiObject) {
+        image::detectObjects(contours, res, config);
+    }
+    if (timer) timer->lap("features");
+}
 
-    return res;
+// Map contours found on a 1 / factor image back to full resolution, each point to the center of the block it stands for
+void image::upscaleContours(vector<vector<Point>> &contours, int factor, Point offset) {
+    Point center(factor / 2, factor / 2);
+    for (int i = 0; i < contours.size(); i++) {
+        for (int j = 0; j < contours[i].size(); j++) {
+            contours[i][j] = contours[i][j] * factor + center + offset;
+        }
+    }
 }
 
-// Calculate features of an image
-Feature image::calculateFeatures(Mat &regions, vector<vector<Point>> &contours, int maxIdx, RotatedRect &bbox, vector<Point> &axisEndPoints) {
-    Feature features;
+// Re-trace upscaled contours at full resolution: only the region they cover, padded by a couple of
+// low resolution pixels, is thresholded again. The region is the largest contour, or in multi-object mode
+// every contour above minArea.
+void image::refineContours(Mat &src, vector<vector<Point>> &contours, int factor, const SegmentConfig &config) {
+    int maxIdx = 0;
+    for (int i = 0; i < contours.size(); i++) {
+        if (contours[i].size() >= contours[maxIdx].size())
+            maxIdx = i;
+    }
+    Rect region = cv::boundingRect(contours[maxIdx]);
+    if (config.multiObject) {
+        for (int i = 0; i < contours.size(); i++) {
+            if (cv::contourArea(contours[i]) >= config.minArea) {
+                region |= cv::boundingRect(contours[i]);
+            }
+        }
+    }
 
+    int pad = 2 * factor;
+    region = Rect(region.x - pad, region.y - pad, region.width + 2 * pad, region.height + 2 * pad) & Rect(0, 0, src.cols, src.rows);
+    if (region.area() == 0) {
+        return;
+    }
+
+    Mat view = src(region);
+    int chosen;
+    Mat thresholded;
+    binaryImage(view, config, thresholded, chosen);
+    vector<vector<Point>> refined;
+    cv::findContours(thresholded, refined, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE, region.tl());
+    if (!refined.empty()) {
+        contours.swap(refined);
+    }
+}
+
+// Find every contour of at least config.minArea pixels and calculate its features, largest first.
+// The regions are independent, so their features are calculated in parallel on the OpenCV thread pool;
+// the list of candidates is kept per thread, so a video stage does not reallocate it every frame.
+void image::detectObjects(vector<vector<Point>> &contours, ImgData &imgData, const SegmentConfig &config) {
+    static thread_local vector<pair<double, int>> candidates;
+    candidates.clear();
+    for (int i = 0; i < contours.size(); i++) {
+        // fitEllipse needs at least 5 points
+        if (contours[i].size() < 5) {
+            continue;
+        }
+        double area = cv::contourArea(contours[i]);
+        if (area >= config.minArea) {
+            candidates.push_back(make_pair(-area, i));
+        }
+    }
+    sort(candidates.begin(), candidates.end());
+
+    vector<Detection> &detections = imgData.detections;
+    detections.resize(candidates.size());
+    for (int i = 0; i < candidates.size(); i++) {
+        detections[i].contour = contours[candidates[i].second];
+        detections[i].area = -candidates[i].first;
+        detections[i].axisEndPoints.clear();
+        detections[i].label.clear();
+    }
+
+    cv::parallel_for_(Range(0, (int)detections.size()), [&](const Range &range) {
+        for (int i = range.start; i < range.end; i++) {
+            Detection &det = detections[i];
+            det.bbox = cv::minAreaRect(det.contour);
+            featuresInto(det.contour, det.bbox, det.features, det.axisEndPoints);
+        }
+    });
+}
+
+// Calculate the features of a contour into features, whose Hu moments keep their memory
+static void featuresInto(vector<Point> &contour, RotatedRect &bbox, Feature &features, vector<Point> &axisEndPoints) {
     // fill ratio
-    double regionArea = cv::contourArea(contours[maxIdx]);
+    double regionArea = cv::contourArea(contour);
     double boundingBoxArea = bbox.size.width * bbox.size.height;
     double fillRatio = regionArea / boundingBoxArea;
     features.fillRatio = fillRatio;
@@ -310,7 +813,7 @@ Feature image::calculateFeatures(Mat &regions, vector<vector<Point>> &contours,
 
     // axises dimension ratio
     // https://docs.opencv.org/3.4/d3/dc0/group__imgproc__shape.html#gaf259efaad93098103d6c27b9e4900ffa
-    RotatedRect rect = cv::fitEllipse(contours[maxIdx]);
+    RotatedRect rect = cv::fitEllipse(contour);
     double axisDimRatio = rect.size.width / rect.size.height;
     if (axisDimRatio > 1)
         axisDimRatio = 1.0 / axisDimRatio;
@@ -325,13 +828,17 @@ Feature image::calculateFeatures(Mat &regions, vector<vector<Point>> &contours,
 
     // hu moments
     // https://docs.opencv.org/3.4/d0/d49/tutorial_moments.html
-    Moments moments = cv::moments(contours[maxIdx], true);  // bool binaryImage as true
-    vector<double> huMoments;
-    cv::HuMoments(moments, huMoments);  // current as 7, resize to 6
+    Moments moments = cv::moments(contour, true);  // bool binaryImage as true
+    double huMoments[7];
+    cv::HuMoments(moments, huMoments);  // current as 7, keep 6
     // the example below shows the last bucket 7 change significantly
     // https://learnopencv.com/shape-matching-using-hu-moments-c-python/
-    huMoments.resize(6);
-    features.huMoments = huMoments;
+    features.huMoments.assign(huMoments, huMoments + 6);
+}
 
+// Calculate features of an image
+Feature image::calculateFeatures(Mat &regions, vector<vector<Point>> &contours, int maxIdx, RotatedRect &bbox, vector<Point> &axisEndPoints) {
+    Feature features;
+    featuresInto(contours[maxIdx], bbox, features, axisEndPoints);
     return features;
 }
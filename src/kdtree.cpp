@@ -0,0 +1,141 @@
+#include "kdtree.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+// Split the rows [begin, end) at the median of their widest dimension, until nodes hold at most leafSize rows
+static int buildNode(KdTree &tree, FeatureModel &model, int begin, int end, int leafSize) {
+    int idx = tree.nodes.size();
+    KdNode node;
+    node.begin = begin;
+    node.end = end;
+    node.left = node.right = -1;
+    node.dim = 0;
+    node.split = 0.0;
+    tree.nodes.push_back(node);
+
+    if (end - begin <= leafSize) {
+        return idx;
+    }
+
+    // widest dimension
+    double maxSpread = 0.0;
+    int dim = 0;
+    for (int d = 0; d < MODEL_DIMS; d++) {
+        double lo = model.cols[d][tree.rows[begin]], hi = lo;
+        for (int i = begin + 1; i < end; i++) {
+            double v = model.cols[d][tree.rows[i]];
+            lo = min(lo, v);
+            hi = max(hi, v);
+        }
+        if (hi - lo > maxSpread) {
+            maxSpread = hi - lo;
+            dim = d;
+        }
+    }
+    // identical rows, nothing to split
+    if (maxSpread == 0.0) {
+        return idx;
+    }
+
+    int mid = (begin + end) / 2;
+    vector<double> &col = model.cols[dim];
+    nth_element(tree.rows.begin() + begin, tree.rows.begin() + mid, tree.rows.begin() + end, [&col](int a, int b) {
+        return col[a] < col[b] || (col[a] == col[b] && a < b);
+    });
+
+    // rows left of mid are <= split, rows from mid on are >= split; read it before the children reorder their rows
+    double split = col[tree.rows[mid]];
+    int left = buildNode(tree, model, begin, mid, leafSize);
+    int right = buildNode(tree, model, mid, end, leafSize);
+    tree.nodes[idx].dim = dim;
+    tree.nodes[idx].split = split;
+    tree.nodes[idx].left = left;
+    tree.nodes[idx].right = right;
+
+    return idx;
+}
+
+// Build the tree over every row of the model
+KdTree kdtree::buildTree(FeatureModel &model, double eps, int leafSize) {
+    KdTree tree;
+    tree.eps = eps;
+    tree.rows.resize(model.numRows);
+    for (int i = 0; i < model.numRows; i++) {
+        tree.rows[i] = i;
+    }
+
+    if (model.numRows > 0) {
+        buildNode(tree, model, 0, model.numRows, max(leafSize, 1));
+    }
+
+    // copy the rows in tree order, so a leaf is scanned from contiguous memory
+    tree.points.resize((size_t)model.numRows * MODEL_DIMS);
+    for (int i = 0; i < model.numRows; i++) {
+        for (int d = 0; d < MODEL_DIMS; d++) {
+            tree.points[(size_t)i * MODEL_DIMS + d] = model.cols[d][tree.rows[i]];
+        }
+    }
+
+    return tree;
+}
+
+// offer a row to the max-heap of the k nearest rows
+static inline void offer(vector<pair<double, int>> &nearest, int k, double dist, int row) {
+    pair<double, int> candidate(dist, row);
+    if (nearest.size() < k) {
+        nearest.push_back(candidate);
+        push_heap(nearest.begin(), nearest.end());
+    } else if (candidate < nearest.front()) {
+        pop_heap(nearest.begin(), nearest.end());
+        nearest.back() = candidate;
+        push_heap(nearest.begin(), nearest.end());
+    }
+}
+
+// Depth-first search, nearer child first.
+// rd is a lower bound of the L1 distance from the query to the node's cell, built from the per-dimension offsets off[],
+// and a far child is only visited if (1 + eps) * rd could still beat the current k-th nearest row.
+static void searchNode(KdTree &tree, int idx, const double *query, int k, double rd, double *off, vector<pair<double, int>> &nearest) {
+    KdNode &node = tree.nodes[idx];
+
+    if (node.left < 0) {
+        for (int i = node.begin; i < node.end; i++) {
+            const double *p = &tree.points[(size_t)i * MODEL_DIMS];
+            double dist = 0.0;
+            for (int d = 0; d < MODEL_DIMS; d++) {
+                dist += fabs(query[d] - p[d]);
+            }
+            offer(nearest, k, dist, tree.rows[i]);
+        }
+        return;
+    }
+
+    double diff = query[node.dim] - node.split;
+    int nearChild = diff <= 0 ? node.left : node.right;
+    int farChild = diff <= 0 ? node.right : node.left;
+
+    searchNode(tree, nearChild, query, k, rd, off, nearest);
+
+    double oldOff = off[node.dim];
+    double farRd = rd - oldOff + fabs(diff);
+    if (nearest.size() < k || farRd * (1.0 + tree.eps) <= nearest.front().first) {
+        off[node.dim] = fabs(diff);
+        searchNode(tree, farChild, query, k, farRd, off, nearest);
+        off[node.dim] = oldOff;
+    }
+}
+
+// Find the k nearest rows of a scaled query
+void kdtree::knnSearch(KdTree &tree, const double *query, int k, vector<pair<double, int>> &nearest) {
+    nearest.clear();
+    if (tree.nodes.empty() || k <= 0) {
+        return;
+    }
+
+    double off[MODEL_DIMS] = {0.0};
+    searchNode(tree, 0, query, k, 0.0, off, nearest);
+    sort_heap(nearest.begin(), nearest.end());
+}
@@ -0,0 +1,267 @@
+#include "model.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "kdtree.hpp"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+// norm of the first 6 buckets of hu moments, as compared by euclideanDist
+static double huNorm(vector<double> &huMoments) {
+    double sum = 0.0;
+    for (int i = 0; i < 6; i++) {
+        sum += huMoments[i] * huMoments[i];
+    }
+    return sqrt(sum);
+}
+
+// Flatten the db into scaled feature columns, rows grouped by label in the db's order
+FeatureModel model::compileModel(map<string, vector<Feature>> &db, Feature &stdDevFeature) {
+    FeatureModel model;
+
+    model.scale[0] = 1.0 / stdDevFeature.fillRatio;
+    model.scale[1] = 1.0 / stdDevFeature.bboxDimRatio;
+    model.scale[2] = 1.0 / stdDevFeature.axisDimRatio;
+    model.scale[3] = 1.0 / huNorm(stdDevFeature.huMoments);
+
+    model.numRows = 0;
+    for (auto &img : db) {
+        model.numRows += img.second.size();
+    }
+    for (int d = 0; d < MODEL_DIMS; d++) {
+        model.cols[d].reserve(model.numRows);
+    }
+
+    for (auto &img : db) {
+        int labelId = model.labels.size();
+        model.labels.push_back(img.first);
+        model.labelCounts.push_back(img.second.size());
+
+        for (Feature &feature : img.second) {
+            double row[MODEL_DIMS];
+            model::scaleFeature(model, feature, row);
+            for (int d = 0; d < MODEL_DIMS; d++) {
+                model.cols[d].push_back(row[d]);
+            }
+            model.labelIds.push_back(labelId);
+        }
+    }
+
+    // sorted values & running sums of each label, for the nearest mean method
+    model.labelStarts.push_back(0);
+    for (int label = 0; label < model.labels.size(); label++) {
+        model.labelStarts.push_back(model.labelStarts.back() + model.labelCounts[label]);
+    }
+    for (int d = 0; d < MODEL_DIMS; d++) {
+        vector<double> &sorted = model.sortedCols[d];
+        sorted = model.cols[d];
+        for (int label = 0; label < model.labels.size(); label++) {
+            sort(sorted.begin() + model.labelStarts[label], sorted.begin() + model.labelStarts[label + 1]);
+        }
+
+        vector<double> &prefix = model.prefixSums[d];
+        prefix.assign(model.numRows + 1, 0.0);
+        for (int i = 0; i < model.numRows; i++) {
+            prefix[i + 1] = prefix[i] + sorted[i];
+        }
+    }
+
+    model.legacyDb = NULL;
+    model.legacyStdDev = NULL;
+
+    return model;
+}
+
+// Reduce a feature to the scaled values the model compares
+void model::scaleFeature(FeatureModel &model, Feature &src, double *query) {
+    query[0] = src.fillRatio * model.scale[0];
+    query[1] = src.bboxDimRatio * model.scale[1];
+    query[2] = src.axisDimRatio * model.scale[2];
+    query[3] = huNorm(src.huMoments) * model.scale[3];
+}
+
+// Sum of absolute differences between the query and every row.
+// Uses AVX (4 rows per step) or SSE2 (2 rows per step) when the compiler targets them; the tail is done in scalar.
+void model::distances(FeatureModel &model, const double *query, double *dists) {
+    const double *c0 = model.cols[0].data();
+    const double *c1 = model.cols[1].data();
+    const double *c2 = model.cols[2].data();
+    const double *c3 = model.cols[3].data();
+    int n = model.numRows;
+    int i = 0;
+
+#if defined(__AVX__)
+    // |x| is x with the sign bit cleared
+    const __m256d signMask = _mm256_set1_pd(-0.0);
+    const __m256d q0 = _mm256_set1_pd(query[0]), q1 = _mm256_set1_pd(query[1]);
+    const __m256d q2 = _mm256_set1_pd(query[2]), q3 = _mm256_set1_pd(query[3]);
+    for (; i + 4 <= n; i += 4) {
+        __m256d sum = _mm256_andnot_pd(signMask, _mm256_sub_pd(q0, _mm256_loadu_pd(c0 + i)));
+        sum = _mm256_add_pd(sum, _mm256_andnot_pd(signMask, _mm256_sub_pd(q1, _mm256_loadu_pd(c1 + i))));
+        sum = _mm256_add_pd(sum, _mm256_andnot_pd(signMask, _mm256_sub_pd(q2, _mm256_loadu_pd(c2 + i))));
+        sum = _mm256_add_pd(sum, _mm256_andnot_pd(signMask, _mm256_sub_pd(q3, _mm256_loadu_pd(c3 + i))));
+        _mm256_storeu_pd(dists + i, sum);
+    }
+#elif defined(__SSE2__)
+    const __m128d signMask = _mm_set1_pd(-0.0);
+    const __m128d q0 = _mm_set1_pd(query[0]), q1 = _mm_set1_pd(query[1]);
+    const __m128d q2 = _mm_set1_pd(query[2]), q3 = _mm_set1_pd(query[3]);
+    for (; i + 2 <= n; i += 2) {
+        __m128d sum = _mm_andnot_pd(signMask, _mm_sub_pd(q0, _mm_loadu_pd(c0 + i)));
+        sum = _mm_add_pd(sum, _mm_andnot_pd(signMask, _mm_sub_pd(q1, _mm_loadu_pd(c1 + i))));
+        sum = _mm_add_pd(sum, _mm_andnot_pd(signMask, _mm_sub_pd(q2, _mm_loadu_pd(c2 + i))));
+        sum = _mm_add_pd(sum, _mm_andnot_pd(signMask, _mm_sub_pd(q3, _mm_loadu_pd(c3 + i))));
+        _mm_storeu_pd(dists + i, sum);
+    }
+#endif
+
+    for (; i < n; i++) {
+        dists[i] = fabs(query[0] - c0[i]) + fabs(query[1] - c1[i]) + fabs(query[2] - c2[i]) + fabs(query[3] - c3[i]);
+    }
+}
+
+// Per-thread buffers reused across queries, so once they have grown to the model's size a query allocates nothing
+struct QueryScratch {
+    vector<double> dists;
+    vector<pair<double, int>> nearest;  // (distance, row), a max-heap while selecting
+    vector<double> votes;
+    vector<double> means;  // average distance to each label
+};
+
+static QueryScratch &queryScratch(FeatureModel &model) {
+    static thread_local QueryScratch scratch;
+    scratch.dists.resize(model.numRows);
+    scratch.votes.resize(model.labels.size());
+    scratch.means.resize(model.labels.size());
+    return scratch;
+}
+
+// Average distance from a scaled query to the rows of every label, the value classify::classifyObject averages.
+// Per dimension, the rows of a label below the query contribute count * q - sum, the rows above sum - count * q,
+// so with the sorted values and running sums the average needs one binary search per label & dimension, not a scan of the rows.
+// The sums are added in another order than the scan's, so the averages agree with it up to floating-point rounding.
+void model::meanDistances(FeatureModel &model, const double *query, double *means) {
+    for (int label = 0; label < model.labels.size(); label++) {
+        int start = model.labelStarts[label];
+        int end = model.labelStarts[label + 1];
+
+        double dist = 0.0;
+        for (int d = 0; d < MODEL_DIMS; d++) {
+            const double *sorted = model.sortedCols[d].data();
+            const double *prefix = model.prefixSums[d].data();
+            double q = query[d];
+
+            int split = upper_bound(sorted + start, sorted + end, q) - sorted;
+            double below = q * (split - start) - (prefix[split] - prefix[start]);
+            double above = (prefix[end] - prefix[split]) - q * (end - split);
+            dist += below + above;
+        }
+        means[label] = dist / (double)model.labelCounts[label];
+    }
+}
+
+// Same rule as classify::classifyObject: the label with the smallest average distance to its rows;
+// only labels whose averages are within rounding of each other can be ranked differently (see --bench classify)
+int model::classifyNearestMeanId(FeatureModel &model, Feature &src, double maxDist) {
+    double query[MODEL_DIMS];
+    model::scaleFeature(model, src, query);
+
+    QueryScratch &scratch = queryScratch(model);
+    model::meanDistances(model, query, scratch.means.data());
+
+    int res = -1;
+    double minDist = maxDist;
+    for (int label = 0; label < model.labels.size(); label++) {
+        if (scratch.means[label] < minDist) {
+            res = label;
+            minDist = scratch.means[label];
+        }
+    }
+
+    return res;
+}
+
+// Build a KD-tree over the rows
+void model::buildIndex(FeatureModel &model, double eps) {
+    model.index = make_shared<KdTree>(kdtree::buildTree(model, eps));
+}
+
+// Select the k nearest rows, with the index or with a scan of every row.
+// The scan keeps the k smallest (distance, row) pairs in a bounded max-heap instead of sorting every distance.
+void model::nearestRows(FeatureModel &model, const double *query, int k, vector<pair<double, int>> &nearest) {
+    if (model.index) {
+        kdtree::knnSearch(*model.index, query, k, nearest);
+        return;
+    }
+
+    QueryScratch &scratch = queryScratch(model);
+    model::distances(model, query, scratch.dists.data());
+
+    // ties go to the lower row
+    nearest.clear();
+    for (int i = 0; i < model.numRows; i++) {
+        pair<double, int> candidate(scratch.dists[i], i);
+        if (nearest.size() < k) {
+            nearest.push_back(candidate);
+            push_heap(nearest.begin(), nearest.end());
+        } else if (candidate < nearest.front()) {
+            pop_heap(nearest.begin(), nearest.end());
+            nearest.back() = candidate;
+            push_heap(nearest.begin(), nearest.end());
+        }
+    }
+    // nearest first
+    sort_heap(nearest.begin(), nearest.end());
+}
+
+// Same rule as classify::classifyObjectByKNN, the majority label of the k nearest rows.
+// When weighted, each neighbor votes with 1 / distance instead of 1.
+int model::classifyKNNId(FeatureModel &model, Feature &src, int k, double maxDist, bool weighted) {
+    QueryScratch &scratch = queryScratch(model);
+    double query[MODEL_DIMS];
+    model::scaleFeature(model, src, query);
+
+    k = min(k, model.numRows);
+    if (k <= 0) {
+        return -1;
+    }
+
+    vector<pair<double, int>> &nearest = scratch.nearest;
+    model::nearestRows(model, query, k, nearest);
+
+    fill(scratch.votes.begin(), scratch.votes.end(), 0.0);
+    double sumKDist = 0.0;
+    double maxVote = 0.0;
+    int maxLabel = -1;
+    for (int i = 0; i < k; i++) {
+        int label = model.labelIds[nearest[i].second];
+        sumKDist += nearest[i].first;
+        scratch.votes[label] += weighted ? 1.0 / (nearest[i].first + 1e-9) : 1.0;
+        if (scratch.votes[label] > maxVote) {
+            maxVote = scratch.votes[label];
+            maxLabel = label;
+        }
+    }
+
+    if ((sumKDist / k) < maxDist) {
+        return maxLabel;
+    }
+    return -1;
+}
+
+string model::classifyNearestMean(FeatureModel &model, Feature &src, double maxDist) {
+    int label = model::classifyNearestMeanId(model, src, maxDist);
+    return label < 0 ? "unknown" : model.labels[label];
+}
+
+string model::classifyKNN(FeatureModel &model, Feature &src, int k, double maxDist, bool weighted) {
+    int label = model::classifyKNNId(model, src, k, maxDist, weighted);
+    return label < 0 ? "unknown" : model.labels[label];
+}
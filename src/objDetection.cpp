@@ -9,11 +9,19 @@
 #include <opencv2/opencv.hpp>
 #include <vector>
 
+#include "alloccount.hpp"
+#include "batch.hpp"
+#include "bench.hpp"
 #include "cascade.hpp"
 #include "classify.hpp"
 #include "csv_util.h"
+#include "featuredb.hpp"
+#include "framesource.hpp"
 #include "image.hpp"
+#include "options.hpp"
+#include "pipeline.hpp"
 #include "process.hpp"
+#include "streams.hpp"
 
 using namespace cv;
 using namespace std;
@@ -23,122 +31,139 @@ using namespace classify;
 using namespace cascade;
 
 /*
-  Given a directory on the command line, scans through the directory for image files.
-  Return the top matched results.
+  Classify objects in photos or a video stream, see options::printUsage for the command line.
+  Settings that are not given on the command line are asked on stdin.
  */
 int main(int argc, char *argv[]) {
-    // Training Images
-    vector<cv::Mat> trainingImgs;
-    vector<std::string> labels;
-    char trainingDir[256];
-    strcpy(trainingDir, "../data/training");
-    process::loadTrainingImages(trainingImgs, trainingDir, labels);
-
-    // get feature vectors of these training models
-    vector<ImgData> traingImgData;
-    for (int i = 0; i < trainingImgs.size(); i++) {
-        traingImgData.push_back(image::calculateImgData(trainingImgs[i]));
-        traingImgData[i].label = labels[i];
-        // cout << i << ":  " << labels[i] << "\n";
-    }
-    cout << "Training images & their labels are loaded.\n"
-         << endl;
+    // count the image buffers allocated, reported per frame by the video pipeline
+    alloccount::installMatCounter();
 
-    // get mean feature vector
-    Feature standardFeature = classify::calculateFeatureStdDev(traingImgData);
+    Options opts;
+    int parsed = options::parseOptions(argc, argv, opts);
+    if (parsed != 0) {
+        return parsed > 0 ? 0 : -1;
+    }
 
-    // get training images' map of labels
-    map<string, vector<Feature>> db;
-    for (ImgData i : traingImgData) {
-        db[i.label].push_back(i.features);
+    if (!opts.bench.empty()) {
+        return bench::runBenchmark(opts.bench, opts.benchInputs);
     }
 
     // Calculation method - Euclidean distance or K-Nearest Neighbor
-    cout << "Enter 'e' for Euclidean distance method, or 'k' for K-Nearest Neighbor method, or 'c' for Haar Cascade\n";
-    bool finish = false;
-    string method;
-    while (!finish) {
-        cin >> method;
-        if (method == "e" || method == "k" || method == "c") {
-            finish = true;
+    if (opts.classifier.method.empty()) {
+        cout << "Enter 'e' for Euclidean distance method, or 'k' for K-Nearest Neighbor method, or 'c' for Haar Cascade\n";
+        string method;
+        while (method != "e" && method != "k" && method != "c") {
+            if (!(cin >> method)) {
+                printf("No method given\n");
+                return (-1);
+            }
         }
+        opts.classifier.method = method;
     }
 
-    if (method == "c") {
+    if (opts.classifier.method == "c") {
         // Reference: Haar-cascade Detection
         // https://docs.opencv.org/3.4/db/d28/tutorial_cascade_classifier.html
-        cascade::cascadeVideoStream();
-        return 0;
+        return cascade::cascadeVideoStream(opts.cascade, opts.videoSource, opts.sourceConfig, opts.headless);
+    }
+
+    // get training images' map of labels, and the standard deviation of each feature
+    // the binary feature database is reused as long as no training image, nor the segmentation settings, has changed
+    const char *trainingDir = opts.trainingDir.c_str();
+    const char *featureDbPath = opts.featureDbPath.c_str();
+    map<string, vector<Feature>> db;
+    Feature standardFeature;
+    FeatureStats trainingStats;
+    vector<featuredb::SourceFile> sources = featuredb::scanSourceFiles(trainingDir);
+    // training features are always taken at full resolution, pyramid mode only speeds up the queries
+    SegmentConfig trainingSegment = opts.segment;
+    trainingSegment.pyramidLevels = 0;
+    trainingSegment.pyramidRefine = false;
+    trainingSegment.multiObject = false;
+    trainingSegment.withDebug = false;
+
+    int64 loadStart = cv::getTickCount();
+    if (featuredb::load(featureDbPath, sources, trainingSegment, db, trainingStats)) {
+        double loadMs = (cv::getTickCount() - loadStart) * 1000.0 / cv::getTickFrequency();
+        printf("Training features are loaded from %s in %.2f ms\n\n", featureDbPath, loadMs);
+    } else {
+        // Training Images & their feature vectors, decoded and analyzed on all cores
+        // the feature statistics are accumulated while the images are analyzed
+        vector<ImgData> traingImgData;
+        process::loadTrainingImgData(traingImgData, trainingDir, opts.numThreads, trainingSegment, &trainingStats);
+        cout << "Training images & their labels are loaded.\n"
+             << endl;
+
+        for (ImgData &i : traingImgData) {
+            db[i.label].push_back(std::move(i.features));
+        }
+
+        if (featuredb::save(featureDbPath, sources, trainingSegment, db, trainingStats) == 0) {
+            printf("Training features are saved to %s\n\n", featureDbPath);
+        }
+    }
+
+    // get the feature standard deviations
+    standardFeature = classify::featureStdDev(trainingStats);
+
+    // flatten the training features for classification
+    FeatureModel featureModel = model::compileModel(db, standardFeature);
+    if (opts.classifier.useIndex) {
+        model::buildIndex(featureModel, opts.classifier.indexEps);
+    }
+    if (opts.classifier.legacy) {
+        featureModel.legacyDb = &db;
+        featureModel.legacyStdDev = &standardFeature;
     }
 
     // Video or Image
-    cout << "Enter 'v' for video processing, or 'p' for photo processing\n";
-    string mode;
-    finish = false;
-    bool isVideo = false;
-    while (!finish) {
-        cin >> mode;
-        if (mode == "p") {
-            isVideo = false;
-            finish = true;
-        } else if (mode == "v") {
-            isVideo = true;
-            finish = true;
+    if (opts.mode.empty()) {
+        cout << "Enter 'v' for video processing, or 'p' for photo processing\n";
+        string mode;
+        while (mode != "v" && mode != "p") {
+            if (!(cin >> mode)) {
+                printf("No mode given\n");
+                return (-1);
+            }
         }
+        opts.mode = mode;
     }
 
-    if (isVideo) {
+    if (opts.mode == "v" && !opts.streams.empty()) {
+        // several sources served by one worker pool, sharing the model
+        cout << "\nStart video mode with " << opts.streams.size() << " streams\n";
+        return streams::runStreams(opts.streams, opts.sourceConfig, featureModel, opts.classifier, opts.segment, opts.pipeline, opts.numThreads);
+    } else if (opts.mode == "v") {
         cout << "\nStart video mode\n";
         // process::classifyObjectByVideo(db, standardFeature);
-        cv::VideoCapture *capdev;
-
-        // open the video device
-        capdev = new cv::VideoCapture(0);
-        if (!capdev->isOpened()) {
-            printf("Unable to open video device\n");
+        // the camera, or a recorded source for a reproducible run
+        FrameSource source;
+        if (!framesource::open(source, opts.videoSource, opts.sourceConfig)) {
+            printf("Unable to open video source %s\n", opts.videoSource.c_str());
             return (-1);
         }
 
         // get some properties of the image
-        cv::Size refS((int)capdev->get(cv::CAP_PROP_FRAME_WIDTH),
-                      (int)capdev->get(cv::CAP_PROP_FRAME_HEIGHT));
+        cv::Size refS = framesource::frameSize(source);
         printf("Expected size: %d %d\n", refS.width, refS.height);
 
-        cv::namedWindow("Video", 2);  // identifies a window, must be different from the above one for haar cascade method
-
-        cv::Mat frame;
-        for (;;) {
-            *capdev >> frame;  // get a new frame from the camera, treat as a stream
-            if (frame.empty()) {
-                printf("frame is empty\n");
-                break;
-            }
-
-            ImgData imgData = image::calculateImgData(frame);
-            if (method == "e") {
-                imgData.label = classify::classifyObject(imgData.features, db, standardFeature);
-            } else if (method == "k") {
-                imgData.label = classify::classifyObjectByKNN(imgData.features, db, standardFeature);
-            }
-
-            process::displayResultsWithFeaturesInVideoFrame(frame, imgData);
-
-            cv::imshow("Video", frame);
-            if (cv::waitKey(10) == 'q') {
-                break;
-            }
+        if (!opts.headless) {
+            cv::namedWindow("Video", 2);  // identifies a window, must be different from the above one for haar cascade method
         }
 
-        delete capdev;
+        // capture, analysis, classification and render run as a pipeline of threads
+        pipeline::runVideoPipeline(source, featureModel, opts.classifier, opts.segment, opts.pipeline);
+    } else if (opts.headless) {
+        // Headless batch evaluation, no windows
+        return batch::runBatchEvaluation(opts.testSource.c_str(), featureModel, opts.classifier, opts.segment,
+                                         opts.numThreads, opts.matrixPath.c_str(), opts.predictionsPath.c_str());
     } else {
         cout << "\nStart image mode\n";
 
         vector<cv::Mat> images;
         vector<string> actualLabels;
-        char dirname[256];
 
-        strcpy(dirname, "../data/testing");
-        process::loadImages(images, dirname, actualLabels);
+        process::loadImages(images, opts.testSource.c_str(), actualLabels);
         cout << "number of images: " << images.size() << "\n\n";
 
         // threshold
@@ -158,16 +183,16 @@ int main(int argc, char *argv[]) {
         // }
         // process::displayResults(results);
 
-        vector<ImgData> res;
+        // the display shows the thresholded image next to the original
+        SegmentConfig displaySegment = opts.segment;
+        displaySegment.withDebug = true;
+
         vector<string> detectedLabels;
         for (int i = 0; i < images.size(); i++) {
-            ImgData imgData = image::calculateImgData(images[i]);
-
-            if (method == "e") {
-                imgData.label = classify::classifyObject(imgData.features, db, standardFeature);
-            } else if (method == "k") {
-                imgData.label = classify::classifyObjectByKNN(imgData.features, db, standardFeature);
-            }
+            ImgData imgData = image::calculateImgData(images[i], displaySegment);
+            // nothing to classify without an object
+            imgData.label = imgData.contour.empty() ? "unknown" : classify::classifyFeature(imgData.features, featureModel, opts.classifier);
+            classify::classifyDetections(imgData.detections, featureModel, opts.classifier);
 
             detectedLabels.push_back(imgData.label);
 
@@ -175,7 +200,7 @@ int main(int argc, char *argv[]) {
             process::displayResultsWithFeaturesAsImage(displayName, imgData);
         }
 
-        process::buildMatrixTable(actualLabels, detectedLabels);
+        process::buildMatrixTable(actualLabels, detectedLabels, opts.matrixPath.c_str());
 
         // NOTE: must add waitKey, or the program will terminate, without showing the result images
         waitKey(0);
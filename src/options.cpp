@@ -0,0 +1,270 @@
+#include "options.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+using namespace std;
+
+Options::Options() {
+    trainingDir = "../data/training";
+    featureDbPath = "../data/features.bin";
+    testSource = "../data/testing";
+    matrixPath = "../data/csv/matrix.csv";
+    predictionsPath = "../data/csv/predictions.csv";
+    videoSource = "0";
+    numThreads = max(1, (int)thread::hardware_concurrency());
+    headless = false;
+    classifier.method = "";
+}
+
+// Print the option surface
+void options::printUsage(const char *program) {
+    printf("Usage: %s [options]\n\n", program);
+    printf("  --method e|k|c          Euclidean distance, K-Nearest Neighbor or Haar cascade (asked on stdin if omitted)\n");
+    printf("  --mode v|p              video or photo processing (asked on stdin if omitted)\n");
+    printf("  --headless              no windows; photo mode runs a batch evaluation\n");
+    printf("  --training <dir>        training images (default ../data/training)\n");
+    printf("  --feature-db <file>     binary feature database (default ../data/features.bin)\n");
+    printf("  --test <dir|list>       test images, a directory or a file listing paths (default ../data/testing)\n");
+    printf("  --matrix <file>         confusion matrix output (default ../data/csv/matrix.csv)\n");
+    printf("  --predictions <file>    per-image predictions output (default ../data/csv/predictions.csv)\n");
+    printf("  --k <n>                 neighbors of the KNN method (default 8)\n");
+    printf("  --weighted              KNN neighbors vote with 1 / distance\n");
+    printf("  --index                 KNN searches a KD-tree index instead of every training feature\n");
+    printf("  --index-eps <e>         approximate KD-tree search within (1 + e) of the true neighbors (default 0, exact)\n");
+    printf("  --legacy                classify with the original scan of every training feature, for validation\n");
+    printf("  --max-dist <d>          distance above which an object is unknown (default 1000)\n");
+    printf("  --threshold <0-255>     gray level threshold of the segmentation (default 100)\n");
+    printf("  --threshold-method <m>  fixed (--threshold), otsu, isodata, or adaptive local mean (default fixed)\n");
+    printf("  --adaptive-block <n>    odd neighborhood size of the adaptive method (default 51)\n");
+    printf("  --adaptive-c <c>        adaptive method: darker than the neighborhood mean by more than c (default 10)\n");
+    printf("  --close <n>             morphological closing iterations of the thresholded image (default 0)\n");
+    printf("  --fused                 threshold & close in cache-sized strips instead of whole-image passes\n");
+    printf("  --pyramid <0-4>         segment at 1/2^n resolution and map the contours back; headless photo mode\n");
+    printf("                          also evaluates full resolution and reports the accuracy difference (default 0)\n");
+    printf("  --refine                --pyramid: re-trace the contours at full resolution around the object\n");
+    printf("  --multi                 detect every object of a frame, not only the largest one\n");
+    printf("  --min-area <px>         smallest contour area of an object in --multi mode (default 1000)\n");
+    printf("  --source <src>          video: camera index, video file, img_%%04d.jpg sequence or image directory (default 0)\n");
+    printf("  --fps <f>               video: deliver recorded frames at f per second, 0 for as fast as possible (default 0)\n");
+    printf("  --loops <n>             video: play a recorded source n times (default 1)\n");
+    printf("  --max-frames <n>        video: stop after n frames of a source, 0 for no limit (default 0)\n");
+    printf("  --streams <a,b,..>      video: serve these sources, each like --source, from one worker pool of --threads\n");
+    printf("  --track                 video: segment a padded roi around the last object between full-frame keyframes\n");
+    printf("  --keyframe <n>          --track: full-frame pass every n frames (default 30)\n");
+    printf("  --roi-pad <f>           --track: roi margin as a fraction of the object size (default 0.5)\n");
+    printf("  --smooth                video: follow objects across frames, reuse labels of unchanged features & smooth them\n");
+    printf("  --cache-eps <d>         --smooth: feature change (scaled L1) below which the last label is reused (default 0.1)\n");
+    printf("  --smooth-window <n>     --smooth: majority vote over the last n labels (default 5)\n");
+    printf("  --scale-factor <f>      cascade: step between the searched face sizes, > 1 (default 1.1)\n");
+    printf("  --min-neighbors <n>     cascade: overlapping hits a face needs (default 3)\n");
+    printf("  --min-face <px>         cascade: smallest face / object side (default 60)\n");
+    printf("  --max-face <px>         cascade: largest face / object side, 0 for no limit (default 0)\n");
+    printf("  --detect-scale <f>      cascade: search faces on the frame resized by f, 0.1 to 1 (default 0.5)\n");
+    printf("  --detect-every <n>      cascade: detect on every n-th frame, extrapolate the faces in between (default 1)\n");
+    printf("  --no-eyes               cascade: do not search eyes\n");
+    printf("  --cascades <a,b,..>     cascade: run these data/haarcascades models instead of faces & eyes, or \"all\"\n");
+    printf("  --threads <n>           worker threads (default: all cores)\n");
+    printf("  --queue <n>             frames buffered between video pipeline stages, at least 2 (default 4)\n");
+    printf("  --no-drop               stall the video pipeline instead of dropping the oldest frames\n");
+    printf("  --report <n>            print video pipeline stats every n frames, 0 to disable (default 100)\n");
+    printf("  --bench <name>          run a micro-benchmark and exit: index, classify, blur, threshold, segment, cascade, streams\n");
+    printf("  --bench-input <a,b,..>  recordings of the streams benchmark, each like --source (default: the test images)\n");
+    printf("  --help                  show this message\n");
+}
+
+// parse an integer option value within [lo, hi]
+static bool parseInt(const char *value, int lo, int hi, int &out) {
+    char *end;
+    long v = strtol(value, &end, 10);
+    if (*value == '\0' || *end != '\0' || v < lo || v > hi) {
+        return false;
+    }
+    out = (int)v;
+    return true;
+}
+
+// parse a positive (or non-negative, if allowZero) floating point option value
+static bool parseDouble(const char *value, bool allowZero, double &out) {
+    char *end;
+    double v = strtod(value, &end);
+    if (*value == '\0' || *end != '\0' || !(v > 0 || (allowZero && v == 0))) {
+        return false;
+    }
+    out = v;
+    return true;
+}
+
+// parse a comma separated, non-empty list
+static bool parseList(const char *value, vector<string> &out) {
+    out.clear();
+    string list = value;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == string::npos) {
+            end = list.size();
+        }
+        if (end > start) {
+            out.push_back(list.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return !out.empty();
+}
+
+// Read the options from the command line
+int options::parseOptions(int argc, char *argv[], Options &opts) {
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+
+        // flags
+        if (arg == "--help" || arg == "-h") {
+            printUsage(argv[0]);
+            return 1;
+        } else if (arg == "--headless") {
+            opts.headless = true;
+            opts.pipeline.headless = true;
+            continue;
+        } else if (arg == "--weighted") {
+            opts.classifier.weighted = true;
+            continue;
+        } else if (arg == "--index") {
+            opts.classifier.useIndex = true;
+            continue;
+        } else if (arg == "--track") {
+            opts.pipeline.tracking.enabled = true;
+            continue;
+        } else if (arg == "--smooth") {
+            opts.pipeline.smoothing.enabled = true;
+            continue;
+        } else if (arg == "--fused") {
+            opts.segment.fused = true;
+            continue;
+        } else if (arg == "--refine") {
+            opts.segment.pyramidRefine = true;
+            continue;
+        } else if (arg == "--multi") {
+            opts.segment.multiObject = true;
+            continue;
+        } else if (arg == "--legacy") {
+            opts.classifier.legacy = true;
+            continue;
+        } else if (arg == "--no-eyes") {
+            opts.cascade.eyes = false;
+            continue;
+        } else if (arg == "--no-drop") {
+            opts.pipeline.dropOldest = false;
+            continue;
+        }
+
+        // options with a value
+        if (i + 1 >= argc) {
+            printf("Missing value for %s\n", arg.c_str());
+            printUsage(argv[0]);
+            return -1;
+        }
+        const char *value = argv[++i];
+        bool ok = true;
+
+        if (arg == "--method") {
+            string method = value;
+            ok = method == "e" || method == "k" || method == "c";
+            opts.classifier.method = method;
+        } else if (arg == "--mode") {
+            string mode = value;
+            ok = mode == "v" || mode == "p";
+            opts.mode = mode;
+        } else if (arg == "--bench") {
+            opts.bench = value;
+        } else if (arg == "--training") {
+            opts.trainingDir = value;
+        } else if (arg == "--feature-db") {
+            opts.featureDbPath = value;
+        } else if (arg == "--test") {
+            opts.testSource = value;
+        } else if (arg == "--matrix") {
+            opts.matrixPath = value;
+        } else if (arg == "--predictions") {
+            opts.predictionsPath = value;
+        } else if (arg == "--k") {
+            ok = parseInt(value, 1, 1000000, opts.classifier.k);
+        } else if (arg == "--max-dist") {
+            ok = parseDouble(value, false, opts.classifier.maxDist);
+        } else if (arg == "--index-eps") {
+            ok = parseDouble(value, true, opts.classifier.indexEps);
+        } else if (arg == "--threshold") {
+            ok = parseInt(value, 0, 255, opts.segment.threshold);
+        } else if (arg == "--min-area") {
+            ok = parseDouble(value, true, opts.segment.minArea);
+        } else if (arg == "--keyframe") {
+            ok = parseInt(value, 1, 100000, opts.pipeline.tracking.keyframeEvery);
+        } else if (arg == "--roi-pad") {
+            ok = parseDouble(value, true, opts.pipeline.tracking.padding);
+        } else if (arg == "--cache-eps") {
+            ok = parseDouble(value, true, opts.pipeline.smoothing.cacheEps);
+        } else if (arg == "--smooth-window") {
+            ok = parseInt(value, 1, 1000, opts.pipeline.smoothing.window);
+        } else if (arg == "--threshold-method") {
+            string method = value;
+            ok = method == "fixed" || method == "otsu" || method == "isodata" || method == "adaptive";
+            opts.segment.thresholdMethod = method;
+        } else if (arg == "--adaptive-block") {
+            ok = parseInt(value, 3, 1001, opts.segment.adaptiveBlock) && opts.segment.adaptiveBlock % 2 == 1;
+        } else if (arg == "--adaptive-c") {
+            ok = parseDouble(value, true, opts.segment.adaptiveC);
+        } else if (arg == "--close") {
+            ok = parseInt(value, 0, 20, opts.segment.closeIterations);
+        } else if (arg == "--pyramid") {
+            ok = parseInt(value, 0, 4, opts.segment.pyramidLevels);
+        } else if (arg == "--scale-factor") {
+            ok = parseDouble(value, false, opts.cascade.scaleFactor) && opts.cascade.scaleFactor > 1.0;
+        } else if (arg == "--min-neighbors") {
+            ok = parseInt(value, 0, 1000, opts.cascade.minNeighbors);
+        } else if (arg == "--min-face") {
+            ok = parseInt(value, 0, 100000, opts.cascade.minFace);
+        } else if (arg == "--max-face") {
+            ok = parseInt(value, 0, 100000, opts.cascade.maxFace);
+        } else if (arg == "--detect-scale") {
+            ok = parseDouble(value, false, opts.cascade.detectScale) && opts.cascade.detectScale >= 0.1 && opts.cascade.detectScale <= 1.0;
+        } else if (arg == "--detect-every") {
+            ok = parseInt(value, 1, 1000, opts.cascade.detectEvery);
+        } else if (arg == "--cascades") {
+            ok = parseList(value, opts.cascade.models);
+        } else if (arg == "--source") {
+            opts.videoSource = value;
+        } else if (arg == "--fps") {
+            ok = parseDouble(value, true, opts.sourceConfig.fps);
+        } else if (arg == "--loops") {
+            ok = parseInt(value, 1, 1000000, opts.sourceConfig.loops);
+        } else if (arg == "--max-frames") {
+            int maxFrames = 0;
+            ok = parseInt(value, 0, 2000000000, maxFrames);
+            opts.sourceConfig.maxFrames = maxFrames;
+        } else if (arg == "--streams") {
+            ok = parseList(value, opts.streams);
+        } else if (arg == "--bench-input") {
+            ok = parseList(value, opts.benchInputs);
+        } else if (arg == "--threads") {
+            ok = parseInt(value, 1, 1024, opts.numThreads);
+        } else if (arg == "--queue") {
+            ok = parseInt(value, 2, 1024, opts.pipeline.queueCapacity);
+        } else if (arg == "--report") {
+            ok = parseInt(value, 0, 1000000, opts.pipeline.reportEvery);
+        } else {
+            printf("Unknown option %s\n", arg.c_str());
+            printUsage(argv[0]);
+            return -1;
+        }
+
+        if (!ok) {
+            printf("Invalid value %s for %s\n", value, arg.c_str());
+            printUsage(argv[0]);
+            return -1;
+        }
+    }
+
+    return 0;
+}
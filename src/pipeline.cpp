@@ -0,0 +1,194 @@
+#include "pipeline.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <opencv2/opencv.hpp>
+#include <thread>
+
+#include "alloccount.hpp"
+#include "classify.hpp"
+#include "process.hpp"
+#include "spscqueue.hpp"
+
+using namespace cv;
+using namespace std;
+
+// a frame travelling down the pipeline, with the results of the stages it went through
+struct FramePacket {
+    long long id;
+    int64 captureTick;
+    Mat frame;
+    ImgData imgData;
+};
+
+// hand a packet to the next stage according to the drop policy
+static void forward(SpscQueue<FramePacket> &queue, FramePacket &packet, bool dropOldest, atomic<bool> &stop) {
+    if (dropOldest) {
+        queue.pushDropOldest(packet);
+    } else {
+        queue.push(packet, stop);
+    }
+}
+
+// add a label and its separator to an FNV-1a hash
+static void hashLabel(unsigned long long &digest, const string &label, char separator) {
+    for (char c : label) {
+        digest = (digest ^ (unsigned char)c) * 1099511628211ULL;
+    }
+    digest = (digest ^ (unsigned char)separator) * 1099511628211ULL;
+}
+
+// Run capture, segmentation & features, classification and render as a pipeline of threads
+// connected by bounded lock-free queues, so the frame rate is set by the slowest stage instead of the sum of all stages.
+int pipeline::runVideoPipeline(FrameSource &source, FeatureModel &model, ClassifyConfig &classifier, SegmentConfig &segment, PipelineConfig &config) {
+    SpscQueue<FramePacket> captured(config.queueCapacity);
+    SpscQueue<FramePacket> analyzed(config.queueCapacity);
+    SpscQueue<FramePacket> classified(config.queueCapacity);
+    // rendered packets go back to the capture stage, so frames & analysis buffers are reused instead of reallocated
+    SpscQueue<FramePacket> recycled(3 * config.queueCapacity + 4);
+
+    // only a camera drops frames, a recorded source waits for the pipeline
+    bool dropOldest = config.dropOldest && source.live;
+
+    // stop is raised by the render stage, each done flag by a stage after its last push
+    atomic<bool> stop(false);
+    atomic<bool> captureDone(false), analyzeDone(false), classifyDone(false);
+
+    thread captureThread([&]() {
+        long long id = 0;
+        FramePacket packet;
+        while (!stop) {
+            recycled.tryPop(packet);
+            if (!framesource::read(source, packet.frame)) {
+                printf("end of the video source\n");
+                break;
+            }
+            packet.id = id++;
+            packet.captureTick = cv::getTickCount();
+            forward(captured, packet, dropOldest, stop);
+        }
+        captureDone = true;
+    });
+
+    thread analyzeThread([&]() {
+        // per-stage timing of the analysis, reported alongside the pipeline stats
+        StageTimer timer;
+        RoiTracker tracker;
+        int analyzedCnt = 0;
+        long long heapSum = 0, heapMax = 0, matSum = 0;
+
+        FramePacket packet;
+        while (!stop && captured.pop(packet, captureDone)) {
+            long long heapBefore = alloccount::heapAllocations(), matBefore = alloccount::matAllocations();
+            tracking::analyzeFrame(tracker, packet.frame, packet.imgData, segment, config.tracking, &timer);
+            long long heap = alloccount::heapAllocations() - heapBefore;
+            heapSum += heap;
+            heapMax = max(heapMax, heap);
+            matSum += alloccount::matAllocations() - matBefore;
+            forward(analyzed, packet, dropOldest, stop);
+
+            if (config.reportEvery > 0 && ++analyzedCnt % config.reportEvery == 0) {
+                timer.report("Average analysis time per frame:");
+                timer.reset();
+                printf("allocations per frame: heap avg %.2f, max %lld | Mat buffers of all threads avg %.2f\n",
+                       (double)heapSum / config.reportEvery, heapMax, (double)matSum / config.reportEvery);
+                heapSum = heapMax = matSum = 0;
+                if (config.tracking.enabled) {
+                    printf("tracking: %lld roi passes, %lld full-frame passes\n", tracker.roiPasses, tracker.fullPasses);
+                    tracker.roiPasses = tracker.fullPasses = 0;
+                }
+            }
+        }
+        analyzeDone = true;
+    });
+
+    thread classifyThread([&]() {
+        LabelTracker tracker;
+        int classifiedCnt = 0;
+
+        FramePacket packet;
+        while (!stop && analyzed.pop(packet, analyzeDone)) {
+            if (config.smoothing.enabled) {
+                tracking::labelFrame(tracker, packet.imgData, model, classifier, config.smoothing);
+            } else {
+                // nothing to classify in an empty frame
+                if (!packet.imgData.contour.empty()) {
+                    packet.imgData.label = classify::classifyFeature(packet.imgData.features, model, classifier);
+                }
+                classify::classifyDetections(packet.imgData.detections, model, classifier);
+            }
+            forward(classified, packet, dropOldest, stop);
+
+            if (config.smoothing.enabled && config.reportEvery > 0 && ++classifiedCnt % config.reportEvery == 0) {
+                printf("labels: %lld classified, %lld cached, %d tracks\n", tracker.classified, tracker.cached, (int)tracker.tracks.size());
+                tracker.classified = tracker.cached = 0;
+            }
+        }
+        classifyDone = true;
+    });
+
+    // render, and collect queue depths & end-to-end latency
+    long long totalRendered = 0;
+    double totalLatency = 0.0;
+    int64 runStart = cv::getTickCount();
+    // FNV-1a hash of every frame's labels in order, to compare the results of two runs at a glance
+    unsigned long long digest = 1469598103934665603ULL;
+    int rendered = 0;
+    double latencySum = 0.0, latencyMax = 0.0;
+    size_t depthSum[3] = {0, 0, 0};
+    int64 windowStart = cv::getTickCount();
+
+    FramePacket packet;
+    while (classified.pop(packet, classifyDone)) {
+        process::displayResultsWithFeaturesInVideoFrame(packet.frame, packet.imgData);
+        if (!config.headless) {
+            cv::imshow("Video", packet.frame);
+        }
+
+        hashLabel(digest, packet.imgData.label, ';');
+        for (Detection &d : packet.imgData.detections) {
+            hashLabel(digest, d.label, ',');
+        }
+
+        double latency = (cv::getTickCount() - packet.captureTick) * 1000.0 / cv::getTickFrequency();
+        totalRendered++;
+        totalLatency += latency;
+        latencySum += latency;
+        latencyMax = max(latencyMax, latency);
+        depthSum[0] += captured.depth();
+        depthSum[1] += analyzed.depth();
+        depthSum[2] += classified.depth();
+        rendered++;
+
+        if (config.reportEvery > 0 && rendered == config.reportEvery) {
+            double seconds = (cv::getTickCount() - windowStart) / cv::getTickFrequency();
+            printf("fps %.1f | latency avg %.1f ms, max %.1f ms | queue depth capture %.2f, analyze %.2f, classify %.2f | dropped %zu, %zu, %zu\n",
+                   rendered / seconds, latencySum / rendered, latencyMax,
+                   (double)depthSum[0] / rendered, (double)depthSum[1] / rendered, (double)depthSum[2] / rendered,
+                   captured.droppedCount(), analyzed.droppedCount(), classified.droppedCount());
+
+            rendered = 0;
+            latencySum = latencyMax = 0.0;
+            depthSum[0] = depthSum[1] = depthSum[2] = 0;
+            windowStart = cv::getTickCount();
+        }
+
+        recycled.tryPush(packet);
+
+        if (!config.headless && cv::waitKey(1) == 'q') {
+            break;
+        }
+    }
+
+    stop = true;
+    captureThread.join();
+    analyzeThread.join();
+    classifyThread.join();
+
+    double seconds = (cv::getTickCount() - runStart) / cv::getTickFrequency();
+    printf("summary: %lld frames in %.2f s, fps %.1f | latency avg %.1f ms | dropped %zu | label digest %016llx\n",
+           totalRendered, seconds, totalRendered / seconds, totalRendered > 0 ? totalLatency / totalRendered : 0.0,
+           captured.droppedCount() + analyzed.droppedCount() + classified.droppedCount(), digest);
+
+    return (0);
+}
@@ -3,12 +3,19 @@
 #include <dirent.h>
 #include <math.h>
 
+#include <algorithm>
+#include <atomic>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <mutex>
 #include <opencv2/opencv.hpp>
+#include <thread>
 #include <vector>
 
 #include "classify.hpp"
 #include "image.hpp"
+#include "workqueue.hpp"
 
 using namespace cv;
 using namespace std;
@@ -28,6 +35,35 @@ void process::printModeDescriptions() {
     std::cout << "i)Gradient Orientation Texture + Hue Saturation \t -key '8' :" << std::endl;
 }
 
+// list the image files in a directory, sorted by name
+vector<string> process::listImageFiles(const char *dirname) {
+    vector<string> names;
+    DIR *dirp;
+    struct dirent *dp;
+
+    dirp = opendir(dirname);
+    if (dirp == NULL) {
+        printf("Cannot open directory %s\n", dirname);
+        return names;
+    }
+
+    while ((dp = readdir(dirp)) != NULL) {
+        // check if the file is an image
+        if (strstr(dp->d_name, ".jpg") ||
+            strstr(dp->d_name, ".jpeg") ||
+            strstr(dp->d_name, ".png") ||
+            strstr(dp->d_name, ".ppm") ||
+            strstr(dp->d_name, ".tif")) {
+            names.push_back(dp->d_name);
+        }
+    }
+
+    closedir(dirp);
+
+    sort(names.begin(), names.end());
+    return names;
+}
+
 // load images from a directory
 void process::loadImages(vector<Mat> &images, const char *dirname, vector<string> &actualLabels) {
     char buffer[256];
@@ -132,6 +168,89 @@ void process::loadTrainingImages(vector<Mat> &images, const char *dirname, vecto
     closedir(dirp);
 }
 
+// a training image read from disk, waiting to be decoded
+struct EncodedImage {
+    int idx;
+    vector<uchar> bytes;
+};
+
+// Load training images and calculate their image data in parallel.
+// One reader thread streams the files into a bounded queue, so memory stays flat however large the directory is,
+// and the workers decode and analyze them. Results are stored by file index in name order,
+// so the output is identical for any number of threads.
+// If stats is given, every worker also accumulates the feature statistics of its images as they are analyzed,
+// and the partial statistics are merged at the end (equal to a sequential pass up to rounding).
+void process::loadTrainingImgData(vector<ImgData> &imgData, const char *dirname, int numThreads, const SegmentConfig &config, FeatureStats *stats) {
+    printf("Processing training images in the directory %s with %d threads\n\n", dirname, numThreads);
+
+    vector<string> names = process::listImageFiles(dirname);
+    imgData.clear();
+    imgData.resize(names.size());
+
+    BoundedQueue<EncodedImage> queue(2 * numThreads);
+    atomic<bool> failed(false);
+    mutex statsMutex;
+
+    vector<thread> workers;
+    for (int t = 0; t < numThreads; t++) {
+        workers.push_back(thread([&]() {
+            FeatureStats localStats;
+            EncodedImage encoded;
+            while (queue.pop(encoded)) {
+                cv::Mat newImage = cv::imdecode(encoded.bytes, cv::IMREAD_COLOR);
+                if (newImage.data == NULL) {
+                    cout << "This new image " << names[encoded.idx] << " cannot be loaded into cv::Mat\n";
+                    failed = true;
+                    continue;
+                }
+
+                ImgData &res = imgData[encoded.idx];
+                res = image::calculateImgData(newImage, config);
+                // no object, no features: the image is left out, its empty label marks it for removal below
+                if (res.contour.empty()) {
+                    cout << "No object is found in the training image " << names[encoded.idx] << ", it is skipped\n";
+                    continue;
+                }
+                // https://stackoverflow.com/questions/14265581/parse-split-a-string-in-c-using-string-delimiter-standard-c
+                res.label = names[encoded.idx].substr(0, names[encoded.idx].find("_"));
+                // training only needs the features, the geometry is freed so a large set stays small
+                vector<Point>().swap(res.contour);
+                vector<Point>().swap(res.axisEndPoints);
+                if (stats) {
+                    classify::addFeature(localStats, res.features);
+                }
+            }
+
+            if (stats) {
+                lock_guard<mutex> lock(statsMutex);
+                classify::mergeFeatureStats(*stats, localStats);
+            }
+        }));
+    }
+
+    for (int i = 0; i < names.size() && !failed; i++) {
+        string path = string(dirname) + "/" + names[i];
+        ifstream file(path.c_str(), ios::binary);
+
+        EncodedImage encoded;
+        encoded.idx = i;
+        encoded.bytes.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        queue.push(std::move(encoded));
+    }
+    queue.close();
+
+    for (int t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+
+    // drop the skipped images, keeping the others in name order
+    imgData.erase(remove_if(imgData.begin(), imgData.end(), [](const ImgData &d) { return d.label.empty(); }), imgData.end());
+
+    if (failed) {
+        exit(-1);
+    }
+}
+
 // display results in separate windows
 void process::displayResults(vector<cv::Mat> &results) {
     float targetWidth = 600;
@@ -189,46 +308,75 @@ void process::displayResultsInOneWindow(vector<cv::Mat> &results) {
     imshow(window_name, dstMat);
 }
 
+// Draw the contour, bounding box, axes and label of every detection
+static void drawDetections(cv::Mat &dst, ImgData &imgData, int lineWidth, double fontScale) {
+    for (int i = 0; i < imgData.detections.size(); i++) {
+        Detection &det = imgData.detections[i];
+        cv::polylines(dst, det.contour, true, Scalar(120, 80, 255), lineWidth * 2);
+
+        Point2f corners[4];
+        det.bbox.points(corners);
+        for (int j = 0; j < 4; j++) {
+            cv::line(dst, corners[j], corners[(j + 1) % 4], Scalar(255, 0, 0), lineWidth);
+        }
+
+        line(dst, det.axisEndPoints[0], det.axisEndPoints[2], Scalar(0, 220, 200), lineWidth);
+        line(dst, det.axisEndPoints[1], det.axisEndPoints[3], Scalar(0, 220, 200), lineWidth);
+
+        Rect rec = det.bbox.boundingRect();
+        cv::putText(dst, det.label, Point(rec.x, rec.y - 10), FONT_HERSHEY_COMPLEX, fontScale, Scalar(0, 128, 255), 2, 16);
+    }
+}
+
 // Display the features besides the original image
 void process::displayResultsWithFeaturesAsImage(string displayName, ImgData &imgData) {
-    Mat temp = imgData.thresholded;
+    // the images are only kept by an analysis with SegmentConfig::withDebug
+    if (!imgData.debug) {
+        return;
+    }
+    Mat original = imgData.debug->original;
+    Mat temp = imgData.debug->thresholded;
     // make 1D channel to 3D
     // https://stackoverflow.com/questions/9970660/convert-1-channel-image-to-3-channel
     cv::Mat thresholded;
     cv::Mat in[] = {temp, temp, temp};
     cv::merge(in, 3, thresholded);
 
-    // draw countours
-    cv::drawContours(thresholded, imgData.contours, 0, Scalar(120, 80, 255), 6);
-
-    // draw bounding box
-    Point2f corners[4];
-    imgData.bbox.points(corners);
-    for (int j = 0; j < 4; j++) {
-        // cv::line(thresholded, corners[j], corners[(j + 1) % 4], Scalar(220, 230, 80), 4);
-        cv::line(thresholded, corners[j], corners[(j + 1) % 4], Scalar(255, 0, 0), 2);
-    }
+    if (!imgData.detections.empty()) {
+        drawDetections(thresholded, imgData, 3, 2);
+    } else if (!imgData.contour.empty()) {
+        // draw countour
+        cv::polylines(thresholded, imgData.contour, true, Scalar(120, 80, 255), 6);
+
+        // draw bounding box
+        Point2f corners[4];
+        imgData.bbox.points(corners);
+        for (int j = 0; j < 4; j++) {
+            // cv::line(thresholded, corners[j], corners[(j + 1) % 4], Scalar(220, 230, 80), 4);
+            cv::line(thresholded, corners[j], corners[(j + 1) % 4], Scalar(255, 0, 0), 2);
+        }
 
-    // draw axes
-    line(thresholded, imgData.axisEndPoints[0], imgData.axisEndPoints[2], Scalar(0, 220, 200), 3);
-    line(thresholded, imgData.axisEndPoints[1], imgData.axisEndPoints[3], Scalar(0, 220, 200), 3);
+        // draw axes
+        line(thresholded, imgData.axisEndPoints[0], imgData.axisEndPoints[2], Scalar(0, 220, 200), 3);
+        line(thresholded, imgData.axisEndPoints[1], imgData.axisEndPoints[3], Scalar(0, 220, 200), 3);
 
-    // draw label
-    // thickness as 4, linetype as 16 - antiaxis
-    Rect rec = imgData.bbox.boundingRect();
-    // put text aside boundingbox
-    // https://stackoverflow.com/questions/56108183/python-opencv-cv2-drawing-rectangle-with-text
-    cv::putText(thresholded, imgData.label, Point(rec.x, rec.y - 10), FONT_HERSHEY_COMPLEX, 2, Scalar(150, 150, 150), 4, 16);
+        // draw label
+        // thickness as 4, linetype as 16 - antiaxis
+        Rect rec = imgData.bbox.boundingRect();
+        // put text aside boundingbox
+        // https://stackoverflow.com/questions/56108183/python-opencv-cv2-drawing-rectangle-with-text
+        cv::putText(thresholded, imgData.label, Point(rec.x, rec.y - 10), FONT_HERSHEY_COMPLEX, 2, Scalar(150, 150, 150), 4, 16);
+    }
 
     float sw = 1024;
     float scale, sh;
-    scale = sw / imgData.original.cols;
-    sh = scale * imgData.original.rows;
-    cv::resize(imgData.original, imgData.original, Size(sw, sh));
+    scale = sw / original.cols;
+    sh = scale * original.rows;
+    cv::resize(original, original, Size(sw, sh));
     cv::resize(thresholded, thresholded, Size(sw, sh));
 
     Mat result(Size(sw * 2, sh), CV_8UC3, Scalar(100, 100, 100));
-    imgData.original.copyTo(result(Rect(0, 0, sw, sh)));
+    original.copyTo(result(Rect(0, 0, sw, sh)));
     thresholded.copyTo(result(Rect(sw, 0, sw, sh)));
 
     cv::namedWindow(displayName, WINDOW_AUTOSIZE);
@@ -236,18 +384,20 @@ void process::displayResultsWithFeaturesAsImage(string displayName, ImgData &img
 }
 
 // Build a confusion matrix table and save it as a .csv file
-void process::buildMatrixTable(vector<string> &actualLabels, vector<string> &detectedLabels) {
+void process::buildMatrixTable(vector<string> &actualLabels, vector<string> &detectedLabels, const char *path) {
     ofstream file;
-    file.open("../data/csv/matrix.csv");
+    file.open(path);
 
     vector<string> labelSet(actualLabels);
+    // a detected label may be missing from the testing images, e.g. "unknown", it still needs its own row
+    labelSet.insert(labelSet.end(), detectedLabels.begin(), detectedLabels.end());
     // get unique labels
     // https://stackoverflow.com/questions/26824260/c-unique-values-in-a-vector
     sort(labelSet.begin(), labelSet.end());
     vector<string>::iterator it;
     it = unique(labelSet.begin(), labelSet.end());
     labelSet.resize(distance(labelSet.begin(), it));
-    // number of unique actual labels from the testing images
+    // number of unique labels from the testing images and the detections
     int n = labelSet.size();
     cout << "label number: " << n << "\n";
 
@@ -353,8 +503,18 @@ void process::buildMatrixTable(vector<string> &actualLabels, vector<string> &det
 
 // Display features in video frame
 int process::displayResultsWithFeaturesInVideoFrame(cv::Mat &frame, ImgData &imgData) {
-    // draw countours
-    cv::drawContours(frame, imgData.contours, 0, Scalar(120, 80, 255), 6);
+    // multi-object mode
+    if (!imgData.detections.empty()) {
+        drawDetections(frame, imgData, 1, 1);
+        return (0);
+    }
+    // nothing found in the frame
+    if (imgData.contour.empty()) {
+        return (0);
+    }
+
+    // draw countour
+    cv::polylines(frame, imgData.contour, true, Scalar(120, 80, 255), 6);
 
     // draw bounding box
     Point2f corners[4];
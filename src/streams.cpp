@@ -0,0 +1,253 @@
+#include "streams.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <opencv2/opencv.hpp>
+#include <thread>
+
+#include "classify.hpp"
+#include "framesource.hpp"
+#include "process.hpp"
+#include "spscqueue.hpp"
+#include "tracking.hpp"
+
+using namespace cv;
+using namespace std;
+
+// a frame of a stream, with its results
+struct StreamPacket {
+    int64 captureTick;
+    Mat frame;
+    ImgData imgData;
+};
+
+// latency & frame counts of a stream since the last report
+struct StreamStats {
+    long long frames;
+    double latencySum;
+    double latencyMax;
+
+    StreamStats() : frames(0), latencySum(0.0), latencyMax(0.0) {}
+};
+
+// one source, and everything that belongs to it alone
+struct Stream {
+    string source;
+    FrameSource capture;  // a camera drops its oldest frames when the workers fall behind, a recording waits for them
+    SpscQueue<StreamPacket> frames;    // capture -> workers
+    SpscQueue<StreamPacket> rendered;  // workers -> display
+    SpscQueue<StreamPacket> recycled;  // back to capture, so frames & analysis buffers are reused
+    atomic<bool> captureDone;
+    // set while a worker processes a frame of the stream: one frame at a time keeps the frames in order
+    // and the tracking state below to a single thread
+    atomic<bool> busy;
+    RoiTracker roiTracker;
+    LabelTracker labelTracker;
+
+    mutex statsMutex;
+    StreamStats window, total;
+
+    Stream(const string &source, int capacity)
+        : source(source), frames(capacity), rendered(capacity), recycled(3 * capacity + 4), captureDone(false), busy(false) {}
+
+    // the queue indexes are cache-line aligned, which plain new only guarantees from C++17 on
+    static void *operator new(size_t size) {
+        void *p;
+        if (posix_memalign(&p, alignof(Stream), size) != 0) {
+            throw bad_alloc();
+        }
+        return p;
+    }
+    static void operator delete(void *p) {
+        free(p);
+    }
+};
+
+// Segment, classify and annotate one frame of a stream
+static void processFrame(Stream &stream, StreamPacket &packet, FeatureModel &model, ClassifyConfig &classifier,
+                         SegmentConfig &segment, pipeline::PipelineConfig &config) {
+    tracking::analyzeFrame(stream.roiTracker, packet.frame, packet.imgData, segment, config.tracking);
+    if (config.smoothing.enabled) {
+        tracking::labelFrame(stream.labelTracker, packet.imgData, model, classifier, config.smoothing);
+    } else {
+        if (!packet.imgData.contour.empty()) {
+            packet.imgData.label = classify::classifyFeature(packet.imgData.features, model, classifier);
+        }
+        classify::classifyDetections(packet.imgData.detections, model, classifier);
+    }
+    process::displayResultsWithFeaturesInVideoFrame(packet.frame, packet.imgData);
+
+    double latency = (cv::getTickCount() - packet.captureTick) * 1000.0 / cv::getTickFrequency();
+    lock_guard<mutex> lock(stream.statsMutex);
+    for (StreamStats *stats : {&stream.window, &stream.total}) {
+        stats->frames++;
+        stats->latencySum += latency;
+        stats->latencyMax = max(stats->latencyMax, latency);
+    }
+}
+
+// Print the frame rate & latency of every stream over a period, and reset the window counters
+static void report(vector<unique_ptr<Stream>> &streams, double seconds, bool total) {
+    long long allFrames = 0;
+    for (size_t i = 0; i < streams.size(); i++) {
+        Stream &stream = *streams[i];
+        lock_guard<mutex> lock(stream.statsMutex);
+        StreamStats &stats = total ? stream.total : stream.window;
+        printf("stream %d %s: fps %.1f | latency avg %.1f ms, max %.1f ms | dropped %zu\n", (int)i, stream.source.c_str(),
+               stats.frames / seconds, stats.frames > 0 ? stats.latencySum / stats.frames : 0.0, stats.latencyMax,
+               stream.frames.droppedCount());
+        allFrames += stats.frames;
+        stream.window = StreamStats();
+    }
+    printf("%s: %d streams, %.1f fps together\n", total ? "total" : "streams", (int)streams.size(), allFrames / seconds);
+}
+
+// Run every source through one shared worker pool
+int streams::runStreams(vector<string> &sources, SourceConfig &sourceConfig, FeatureModel &model, ClassifyConfig &classifier, SegmentConfig &segment,
+                        pipeline::PipelineConfig &config, int numWorkers) {
+    vector<unique_ptr<Stream>> streams;
+    for (const string &source : sources) {
+        unique_ptr<Stream> stream(new Stream(source, config.queueCapacity));
+        if (!framesource::open(stream->capture, source, sourceConfig)) {
+            printf("Unable to open video source %s\n", source.c_str());
+            return (-1);
+        }
+        Size size = framesource::frameSize(stream->capture);
+        printf("stream %d: %s, %dx%d\n", (int)streams.size(), source.c_str(), size.width, size.height);
+        streams.push_back(std::move(stream));
+    }
+    if (streams.empty()) {
+        return (-1);
+    }
+
+    // the workers already keep the cores busy, OpenCV's own pool would only oversubscribe them
+    int poolThreads = cv::getNumThreads();
+    cv::setNumThreads(1);
+
+    atomic<bool> stop(false);
+    // workers still running, the display drains the rendered frames until there are none
+    atomic<int> activeWorkers(numWorkers);
+
+    vector<thread> captureThreads;
+    for (size_t i = 0; i < streams.size(); i++) {
+        Stream &stream = *streams[i];
+        captureThreads.push_back(thread([&stream, &stop]() {
+            StreamPacket packet;
+            while (!stop) {
+                stream.recycled.tryPop(packet);
+                if (!framesource::read(stream.capture, packet.frame)) {
+                    break;
+                }
+                packet.captureTick = cv::getTickCount();
+                if (stream.capture.live) {
+                    stream.frames.pushDropOldest(packet);
+                } else if (!stream.frames.push(packet, stop)) {
+                    break;
+                }
+            }
+            stream.captureDone = true;
+        }));
+    }
+
+    // Every worker takes the streams in turn from a shared cursor, skipping the busy & empty ones,
+    // so one fast source cannot starve the others
+    atomic<size_t> cursor(0);
+    vector<thread> workers;
+    for (int w = 0; w < numWorkers; w++) {
+        workers.push_back(thread([&]() {
+            StreamPacket packet;
+            for (int idle = 0; !stop;) {
+                bool worked = false;
+                bool allDone = true;
+                for (size_t k = 0; k < streams.size() && !worked; k++) {
+                    Stream &stream = *streams[cursor.fetch_add(1) % streams.size()];
+                    bool done = stream.captureDone.load();
+                    if (stream.busy.exchange(true)) {
+                        allDone = false;
+                        continue;
+                    }
+                    if (stream.frames.tryPop(packet)) {
+                        processFrame(stream, packet, model, classifier, segment, config);
+                        if (config.headless) {
+                            stream.recycled.tryPush(packet);
+                        } else {
+                            stream.rendered.pushDropOldest(packet);
+                        }
+                        worked = true;
+                    } else if (!done) {
+                        allDone = false;
+                    }
+                    stream.busy = false;
+                }
+
+                if (worked) {
+                    idle = 0;
+                } else if (allDone) {
+                    break;
+                } else if (++idle > 64) {
+                    this_thread::sleep_for(chrono::microseconds(200));
+                }
+            }
+            activeWorkers--;
+        }));
+    }
+
+    // display & report on the calling thread, as highgui requires
+    if (!config.headless) {
+        for (size_t i = 0; i < streams.size(); i++) {
+            cv::namedWindow("Stream " + to_string(i), 2);
+        }
+    }
+    int64 start = cv::getTickCount(), windowStart = start;
+    long long reported = 0;
+    StreamPacket packet;
+    while (activeWorkers > 0) {
+        bool shown = false;
+        if (!config.headless) {
+            for (size_t i = 0; i < streams.size(); i++) {
+                if (streams[i]->rendered.tryPop(packet)) {
+                    cv::imshow("Stream " + to_string(i), packet.frame);
+                    streams[i]->recycled.tryPush(packet);
+                    shown = true;
+                }
+            }
+            if (cv::waitKey(1) == 'q') {
+                break;
+            }
+        }
+        if (!shown) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+
+        long long processed = 0;
+        for (unique_ptr<Stream> &stream : streams) {
+            lock_guard<mutex> lock(stream->statsMutex);
+            processed += stream->total.frames;
+        }
+        if (config.reportEvery > 0 && processed - reported >= config.reportEvery) {
+            report(streams, (cv::getTickCount() - windowStart) / cv::getTickFrequency(), false);
+            reported = processed;
+            windowStart = cv::getTickCount();
+        }
+    }
+
+    stop = true;
+    for (thread &t : workers) {
+        t.join();
+    }
+    for (thread &t : captureThreads) {
+        t.join();
+    }
+
+    cv::setNumThreads(poolThreads);
+
+    report(streams, (cv::getTickCount() - start) / cv::getTickFrequency(), true);
+    return (0);
+}
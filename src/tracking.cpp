@@ -0,0 +1,177 @@
+#include "tracking.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <opencv2/opencv.hpp>
+
+using namespace cv;
+using namespace std;
+
+// the upright box around everything found in a frame
+static Rect objectBounds(ImgData &imgData) {
+    if (imgData.detections.empty()) {
+        return imgData.bbox.boundingRect();
+    }
+    Rect bounds = imgData.detections[0].bbox.boundingRect();
+    for (int i = 1; i < imgData.detections.size(); i++) {
+        bounds |= imgData.detections[i].bbox.boundingRect();
+    }
+    return bounds;
+}
+
+// The roi result is only kept if the object is found and lies inside the roi,
+// away from any roi edge that is not also a frame edge; an object cut by the roi may have moved out of it.
+static bool insideRoi(ImgData &imgData, Rect &roi, Size frameSize) {
+    if (imgData.contour.empty()) {
+        return false;
+    }
+    Rect bounds = objectBounds(imgData);
+    if (bounds.x <= roi.x && roi.x > 0) return false;
+    if (bounds.y <= roi.y && roi.y > 0) return false;
+    if (bounds.x + bounds.width >= roi.x + roi.width && roi.x + roi.width < frameSize.width) return false;
+    if (bounds.y + bounds.height >= roi.y + roi.height && roi.y + roi.height < frameSize.height) return false;
+    return true;
+}
+
+// Segment the padded roi of the last frame's object instead of the full frame.
+// A full-frame pass runs on a keyframe, when there is no track yet, or when the object is lost from the roi.
+void tracking::analyzeFrame(RoiTracker &tracker, Mat &frame, ImgData &res, const SegmentConfig &segment, const TrackConfig &config, StageTimer *timer) {
+    bool tracked = false;
+
+    if (config.enabled && tracker.active && tracker.sinceKeyframe < config.keyframeEvery) {
+        image::analyzeImage(frame, res, segment, timer, tracker.roi);
+        tracked = insideRoi(res, tracker.roi, frame.size());
+    }
+
+    if (tracked) {
+        tracker.roiPasses++;
+        tracker.sinceKeyframe++;
+    } else {
+        image::analyzeImage(frame, res, segment, timer);
+        tracker.fullPasses++;
+        tracker.sinceKeyframe = 0;
+    }
+
+    // next roi: the object's box, padded on every side & clipped to the frame
+    tracker.active = config.enabled && !res.contour.empty();
+    if (tracker.active) {
+        Rect bounds = objectBounds(res);
+        int padX = (int)(bounds.width * config.padding) + 1;
+        int padY = (int)(bounds.height * config.padding) + 1;
+        Rect padded(bounds.x - padX, bounds.y - padY, bounds.width + 2 * padX, bounds.height + 2 * padY);
+        tracker.roi = padded & Rect(0, 0, frame.cols, frame.rows);
+        tracker.active = tracker.roi.area() > 0;
+    }
+}
+
+// the most frequent label of the history, and its count; ties keep the current label
+static string majorityLabel(LabelTrack &track, int &votes) {
+    string best = track.stableLabel;
+    votes = 0;
+    for (int i = 0; i < track.history.size(); i++) {
+        if (track.history[i] == best) votes++;
+    }
+    for (int i = 0; i < track.history.size(); i++) {
+        int count = 0;
+        for (int j = 0; j < track.history.size(); j++) {
+            if (track.history[j] == track.history[i]) count++;
+        }
+        if (count > votes) {
+            best = track.history[i];
+            votes = count;
+        }
+    }
+    return best;
+}
+
+// Label one object through its track
+static string labelObject(LabelTracker &tracker, LabelTrack &track, bool fresh, Feature &features, FeatureModel &model, ClassifyConfig &classifier, const SmoothConfig &config) {
+    double query[MODEL_DIMS];
+    model::scaleFeature(model, features, query);
+
+    double moved = 0.0;
+    for (int d = 0; d < MODEL_DIMS; d++) {
+        moved += fabs(query[d] - track.query[d]);
+    }
+
+    // features close to the last classified frame keep its label
+    string label;
+    if (!fresh && moved < config.cacheEps) {
+        label = track.lastLabel;
+        tracker.cached++;
+    } else {
+        label = classify::classifyFeature(features, model, classifier);
+        copy(query, query + MODEL_DIMS, track.query);
+        track.lastLabel = label;
+        tracker.classified++;
+    }
+
+    track.history.push_back(label);
+    while (track.history.size() > config.window) {
+        track.history.pop_front();
+    }
+
+    // a new label has to hold more than half of the window before it replaces the stable one
+    int votes;
+    string majority = majorityLabel(track, votes);
+    if (fresh || (majority != track.stableLabel && votes * 2 > (int)track.history.size())) {
+        track.stableLabel = majority;
+    }
+
+    return track.stableLabel;
+}
+
+// Match every object of the frame to the nearest unused track whose center is within the object's size,
+// or start a new track; tracks unseen for a whole window are dropped
+void tracking::labelFrame(LabelTracker &tracker, ImgData &imgData, FeatureModel &model, ClassifyConfig &classifier, const SmoothConfig &config) {
+    // the objects of the frame: every detection in multi-object mode, else the largest contour
+    vector<RotatedRect *> boxes;
+    vector<Feature *> features;
+    vector<string *> labels;
+    if (!imgData.detections.empty()) {
+        for (int i = 0; i < imgData.detections.size(); i++) {
+            boxes.push_back(&imgData.detections[i].bbox);
+            features.push_back(&imgData.detections[i].features);
+            labels.push_back(&imgData.detections[i].label);
+        }
+    } else if (!imgData.contour.empty()) {
+        boxes.push_back(&imgData.bbox);
+        features.push_back(&imgData.features);
+        labels.push_back(&imgData.label);
+    }
+
+    vector<char> used(tracker.tracks.size(), 0);
+    for (int i = 0; i < boxes.size(); i++) {
+        Point2f center = boxes[i]->center;
+        double reach = max(boxes[i]->size.width, boxes[i]->size.height);
+
+        int match = -1;
+        double matchDist = reach;
+        for (int t = 0; t < tracker.tracks.size(); t++) {
+            double dist = norm(tracker.tracks[t].center - center);
+            if (!used[t] && dist <= matchDist) {
+                match = t;
+                matchDist = dist;
+            }
+        }
+
+        bool fresh = match < 0;
+        if (fresh) {
+            tracker.tracks.push_back(LabelTrack());
+            used.push_back(0);
+            match = tracker.tracks.size() - 1;
+        }
+        used[match] = 1;
+
+        LabelTrack &track = tracker.tracks[match];
+        track.center = center;
+        track.missed = 0;
+        *labels[i] = labelObject(tracker, track, fresh, *features[i], model, classifier, config);
+    }
+
+    for (int t = tracker.tracks.size() - 1; t >= 0; t--) {
+        if (!used[t] && ++tracker.tracks[t].missed >= config.window) {
+            tracker.tracks.erase(tracker.tracks.begin() + t);
+        }
+    }
+}